@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdatomic.h>
 
 typedef struct {
     uint8_t* buffer;
@@ -21,4 +22,49 @@ void cb_write_string(circular_buffer* buf, const char* src);
 void cb_reset(circular_buffer* buf);
 bool cb_read(circular_buffer* buf, uint8_t* dst);
 
+/*
+ * Lock-free triple buffer for one producer and one consumer thread.
+ */
+typedef struct {
+    uint8_t* buffer;
+    size_t len;
+
+    // Only touched by the producer, resp. the consumer.
+    unsigned int back, latest, front;
+
+    // Index of the most recently published buffer, or'ed with TB_FRESH
+    // until it has been acquired.
+    atomic_uint ready;
+} triple_buffer;
+
+triple_buffer* tb_init(size_t len);
+void tb_destroy(triple_buffer* tb);
+uint8_t* tb_back(triple_buffer* tb);
+bool tb_publish(triple_buffer* tb);
+const uint8_t* tb_latest(const triple_buffer* tb);
+bool tb_acquire(triple_buffer* tb);
+const uint8_t* tb_front(const triple_buffer* tb);
+
+/*
+ * Lock-free queue of <num> items for one producer and one consumer
+ * thread.
+ */
+typedef struct {
+    uint8_t* buffer;
+    size_t len, num;
+
+    // Free running positions of the next item to be written, resp. read.
+    atomic_size_t write, read;
+} ring_buffer;
+
+ring_buffer* rb_init(size_t num, size_t len);
+void rb_destroy(ring_buffer* rb);
+uint8_t* rb_reserve(ring_buffer* rb);
+void rb_commit(ring_buffer* rb);
+const uint8_t* rb_peek(ring_buffer* rb);
+void rb_release(ring_buffer* rb);
+size_t rb_used(ring_buffer* rb);
+size_t rb_write(ring_buffer* rb, const void* src, size_t count);
+size_t rb_read(ring_buffer* rb, void* dst, size_t count);
+
 #endif//__BUFFERS_H__
@@ -11,6 +11,8 @@
 #include "graphics.h"
 #include "timers.h"
 #include "sound.h"
+#include "scheduler.h"
+#include "joypad.h"
 
 #include "buffers.h"
 
@@ -18,8 +20,8 @@
 #   include "set.h"
 #endif
 
-#define CYCLES_PER_FRAME (70886)
-#define TICKS_PER_FRAME (17)
+// 154 lines of 456 cycles, about 59.73 frames per second.
+#define CYCLES_PER_FRAME (70224)
 
 typedef enum stopflags {
     STOP_STEP = 1,
@@ -41,17 +43,40 @@ struct context {
     
     sound_t snd;
 
-    // Point in time of the next run,
-    // in ticks. Used to slow down
-    // emulator if needed.
+    // Cycles executed since the current frame started, resp. since the
+    // context was created.
+    unsigned int frame_cycles;
+    uint64_t cycles;
+
+    // Events due at an exact cycle.
+    scheduler_t sched;
+
+    // Performance counter value at which the next frame is due, and the
+    // fraction of a tick left over from the frame length, in 1/CLOCKSPEED
+    // ticks. Used to slow down the emulator, see context_advance_next_run.
     uint64_t next_run;
+    uint64_t next_run_fraction;
 
     // Joypad
     uint8_t joypad_state;
+    input_queue_t input;
+
+    // Whether input is polled when the game reads it instead of between
+    // frames, and ctx->cycles at the last poll. See joypad_write.
+    bool late_polling;
+    uint64_t joypad_polled;
+
+    // Frames run ahead of the one that is kept, and where the kept one is
+    // saved meanwhile. See context_set_run_ahead.
+    unsigned int run_ahead;
+    struct snapshot* snapshot;
     
     execution_state_t state;
     bool running;
 
+    // No window, sound or input, see context_create_headless.
+    bool headless;
+
 #if defined(DEBUG)
     circular_buffer* logs;
     circular_buffer* traceback;
@@ -63,6 +88,9 @@ struct context {
     void* update_func_context;
 };
 
-bool context_init_minimal(context_t *ctx);
+bool context_init_minimal(context_t *ctx, bool headless);
+void context_destroy_minimal(context_t *ctx);
+bool context_run_frame_ahead(context_t *ctx);
+void context_advance_next_run(context_t *ctx, uint64_t freq);
 
 #endif//__CONTEXT_H__
@@ -3,15 +3,13 @@
 
 #include "spielbub.h"
 
-#define DBG_TILES_PER_ROW (32)
-
 typedef struct debug debug_t;
 
 typedef void (*command_t)(const char* args, context_t* ctx, debug_t* dbg);
 
 struct debug {
-    window_t* window;
-    bool show_tiles;
+    // Open viewers, indexed by viewer_kind_t.
+    viewer_t* viewers[3];
 
     char commandline[256];
     command_t previous_command;
@@ -19,7 +17,8 @@ struct debug {
 
 bool debug_init(debug_t* dbg);
 void debug_free(debug_t *dbg);
-void debug_draw_tiles(const context_t* ctx, debug_t* dbg);
+void debug_toggle_viewer(debug_t* dbg, viewer_kind_t kind);
+void debug_update_viewers(const context_t* ctx, debug_t* dbg);
 void debug_print_func(const context_t* ctx, uint16_t addr);
 void debug_print_addr(const context_t* ctx, uint16_t addr);
 void debug_print_pc(context_t* ctx);
@@ -5,11 +5,13 @@
 
 #include "spielbub.h"
 
+#include "memory.h"
 #include "window.h"
 
 #define SPRITES_PER_LINE (10)
 #define MAP_WIDTH (256)
 #define MAP_HEIGHT (256)
+#define MAX_REGISTER_WRITES (256)
 
 typedef enum {
     HBLANK = 0x00, VBLANK, OAM, TRANSF, HBLANK_WAIT, VBLANK_WAIT, OAM_WAIT
@@ -19,7 +21,153 @@ typedef struct {
     uint8_t colors[4];
 } palette_t;
 
+typedef struct recorder recorder_t;
+
+// A PPU implementation, see graphics_set_backend.
+typedef struct gfx_backend {
+    void (*update)(context_t *ctx, int cycles);
+    void (*write)(context_t *ctx, uint16_t addr, uint8_t value);
+
+    // Starts over at the first line of a frame.
+    void (*reset)(context_t *ctx);
+} gfx_backend_t;
+
+extern const gfx_backend_t gfx_fast_backend;
+extern const gfx_backend_t gfx_fifo_backend;
+
+typedef struct sprite {
+    // Screen coordinates of the top left corner, can be negative.
+    int x, y;
+
+    bool in_background;
+    bool flip_x, flip_y;
+    bool high_palette;
+
+    uint8_t tile_id;
+} sprite_t;
+
+typedef struct {
+    size_t length;
+    sprite_t data[SPRITES_PER_LINE];
+} sprite_table_t;
+
+// A sprite pixel waiting to be mixed with the background.
+typedef struct fifo_pixel {
+    uint8_t color;
+    bool    in_background;
+    bool    high_palette;
+} fifo_pixel_t;
+
+// State of the accurate PPU, see graphics/fifo.c.
+typedef struct fifo {
+    // Dot within the current line, and the next pixel to be output.
+    int          dot;
+    int          lx;
+
+    // Background pixels still to be thrown away, for SCX resp. WX < 7.
+    int          discard;
+
+    // The background FIFO holds up to a tile line as two bit planes.
+    uint8_t      bg_low, bg_high;
+    int          bg_len;
+
+    fifo_pixel_t obj[TILE_WIDTH];
+    int          obj_len;
+
+    // Background fetcher: dots spent on the current tile, the tile
+    // column and the data fetched so far.
+    int          step;
+    uint8_t      fetch_x;
+    uint8_t      tile_id, tile_y, tile_low, tile_high;
+
+    // WY has to match LY once per frame before the window is displayed.
+    bool         window_triggered;
+    bool         in_window;
+
+    // Sprites found by the OAM scan, in OAM order.
+    sprite_t     sprites[SPRITES_PER_LINE];
+    bool         fetched[SPRITES_PER_LINE];
+    size_t       sprites_len;
+
+    // Remaining dots of the sprite fetch in progress.
+    int          obj_fetch;
+    size_t       obj_index;
+
+    bool         lcd_off;
+
+    // Finished pixels of the current line, one row per gfx->layers.
+    uint8_t      line[3][SCREEN_WIDTH];
+} fifo_t;
+
+// A tile map, rendered into color indexes.
+typedef struct plane {
+    uint8_t  pixels[MAP_HEIGHT][MAP_WIDTH];
+
+    // Tile and tile version each map entry was drawn with.
+    uint16_t tiles[MAP_ROWS][MAP_COLUMNS];
+    uint32_t versions[MAP_ROWS][MAP_COLUMNS];
+
+    // gfx->vram_version and addressing mode at the last update.
+    uint32_t vram_version;
+    bool     signed_ids;
+} plane_t;
+
+// A compact, possibly downsampled copy of each drawn frame.
+typedef struct observer {
+    observation_format_t format;
+    size_t   width, height;
+    bool     max_pool;
+
+    // Destination column resp. row of every screen pixel, and how many
+    // screen pixels make up each destination pixel.
+    uint8_t  columns[SCREEN_WIDTH], rows[SCREEN_HEIGHT];
+    uint8_t  column_sizes[SCREEN_WIDTH], row_sizes[SCREEN_HEIGHT];
+
+    // Sums of the destination row that is currently being built.
+    uint32_t sums[SCREEN_WIDTH];
+
+    // The previous emulated frame, for max pooling. Drawn even if it was
+    // skipped, see gfx_t.pooled.
+    uint8_t  previous[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+    uint8_t  pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+} observer_t;
+
+// Upscales frames of color indexes, see graphics/scale.c.
+typedef struct scaler {
+    scale_filter_t filter;
+    unsigned int factor;
+    size_t   width, height;
+
+    // Hash of the frame in pixels, if valid. Frames are only scaled
+    // again if the hash changes.
+    uint64_t hash;
+    bool     valid;
+    uint64_t scaled;
+
+    uint8_t* pixels;
+
+    // Source of the current pass, with a border of repeated pixels.
+    uint8_t* padded;
+} scaler_t;
+
+// PPU registers that change how a line is drawn.
+typedef struct gfx_regs {
+    uint8_t LCDC, SCY, SCX, BGP, SPP_LOW, SPP_HIGH, WY, WX;
+} gfx_regs_t;
+
+// A register write that happened while the screen was being drawn.
+typedef struct gfx_write {
+    uint8_t  ly;
+    uint16_t addr;
+    uint8_t  value;
+} gfx_write_t;
+
 typedef struct gfx {
+    // Set by graphics_set_backend.
+    const gfx_backend_t* backend;
+    fifo_t       fifo;
+
     // Number of cycles in the current state.
     int          cycles;
     
@@ -30,6 +178,54 @@ typedef struct gfx {
     // Current state.
     gfx_state_t state;
 
+    // First screen line that has not been drawn yet. Lines are drawn
+    // lazily, usually all at once on VBLANK.
+    int          next_line;
+
+    // Register values as seen by next_line. Only valid while there
+    // are logged writes.
+    gfx_regs_t   regs;
+
+    // Register writes that still have to be replayed for lines that
+    // have not been drawn yet.
+    gfx_write_t  writes[MAX_REGISTER_WRITES];
+    size_t       writes_len, writes_read;
+
+    // Incremented on writes to VRAM, resp. to a single tile.
+    uint32_t     vram_version;
+    uint32_t     tile_versions[MAX_TILES];
+
+    // Background and window planes, one for each tile map.
+    plane_t      planes[2];
+
+    // Only every frame_skip-th frame is drawn and presented.
+    unsigned int frame_skip;
+    unsigned int frames_until_drawn;
+    bool         skip_frame;
+    uint64_t     frames_drawn, frames_skipped;
+
+    // The frame is skipped, but drawn for max pooling with the next one.
+    bool         pooled;
+
+    // Frames started while this is set are skipped as well, regardless of
+    // frame_skip. Used for frames that are run ahead and undone again.
+    bool         hidden;
+
+    // Finished frames on their way to the window.
+    triple_buffer* frames;
+    uint64_t     frames_dropped;
+
+    // Observation of the last drawn frame, see graphics_set_observation.
+    observer_t   observer;
+
+    // Scales frames for graphics_get_scaled_frame and new recordings.
+    scaler_t     scaler;
+
+    // Finished frames are also recorded here, if set.
+    recorder_t*  recorder;
+
+    // There is no window, see graphics_init.
+    bool     headless;
     window_t window;
 
     int debug_flags;
@@ -41,28 +237,24 @@ typedef struct gfx {
     SDL_Surface* layers[3];
 } gfx_t;
 
-typedef struct sprite {
-    size_t x, y;
-
-    bool visible;
-    bool in_background;
-    bool flip_x, flip_y;
-    bool high_palette;
-
-    uint16_t tile_id;
-    size_t tile_x, tile_y;
-} sprite_t;
-
-typedef struct {
-    size_t length;
-    sprite_t data[SPRITES_PER_LINE];
-} sprite_table_t;
-
-bool graphics_init(gfx_t *gfx);
+bool graphics_init(gfx_t *gfx, bool headless);
 void graphics_destroy(gfx_t *gfx);
+void graphics_map_colors(window_t *window);
 bool graphics_lock(context_t *ctx);
 void graphics_unlock(context_t *ctx);
 void graphics_update(context_t *ctx, int cycles);
+void graphics_write(context_t *ctx, uint16_t addr, uint8_t value);
+void graphics_catch_up(context_t *ctx, int line);
+void graphics_present(context_t *ctx);
+void graphics_pool(context_t *ctx);
+void graphics_track_vram(gfx_t *gfx, uint16_t addr);
+void graphics_set_mode(context_t *ctx, gfx_state_t state);
+void graphics_frame_start(context_t *ctx);
+void graphics_frame_end(context_t *ctx);
+palette_t graphics_palette_decode(uint8_t raw_palette);
+void graphics_sprite_decode(sprite_t *sprite, const memory_oam_t* oam);
+const memory_tile_t* graphics_sprite_tile(const memory_t *mem,
+    const sprite_t *sprite, int line, size_t *tile_y);
 void graphics_sprite_table_add(sprite_table_t *table, const sprite_t* sprite);
 
 #endif//__GRAPHICS_H__
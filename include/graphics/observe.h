@@ -0,0 +1,12 @@
+#ifndef __GRAPHICS_OBSERVE_H__
+#define __GRAPHICS_OBSERVE_H__
+
+#include "graphics.h"
+
+bool observer_init(observer_t* obs, observation_format_t format,
+    size_t width, size_t height, bool max_pool);
+void observer_line(observer_t* obs, const uint8_t* line, size_t y);
+bool observer_wants_previous(const observer_t* obs);
+size_t observer_size(const observer_t* obs);
+
+#endif//__GRAPHICS_OBSERVE_H__
@@ -0,0 +1,14 @@
+#ifndef __GRAPHICS_PLANES_H__
+#define __GRAPHICS_PLANES_H__
+
+#include "context.h"
+#include "ioregs.h"
+#include "graphics/tiles.h"
+
+void plane_invalidate(plane_t* plane);
+const plane_t* plane_get(gfx_t* gfx, const memory_t* mem, tile_map_t tile_map);
+
+void plane_draw_line(dest_t* restrict dst, const plane_t* restrict plane,
+    size_t x, size_t y, palette_t palette);
+
+#endif//__GRAPHICS_PLANES_H__
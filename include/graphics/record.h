@@ -0,0 +1,26 @@
+#ifndef __GRAPHICS_RECORD_H__
+#define __GRAPHICS_RECORD_H__
+
+#include "graphics.h"
+#include "writer.h"
+
+struct recorder {
+    writer_t*       writer;
+    record_format_t format;
+
+    // Only used by the writer thread, frames are scaled while they are
+    // encoded.
+    scaler_t        scaler;
+    char            ppm_header[32];
+    size_t          ppm_header_len;
+
+    // Only every <every>th frame is recorded.
+    unsigned int    every, until_recorded;
+};
+
+recorder_t* recorder_open(const char* filename, record_format_t format,
+    unsigned int every, scale_filter_t filter, unsigned int factor);
+void recorder_push(recorder_t* recorder, const frame_t* frame);
+bool recorder_close(recorder_t* recorder);
+
+#endif//__GRAPHICS_RECORD_H__
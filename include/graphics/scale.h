@@ -0,0 +1,12 @@
+#ifndef __GRAPHICS_SCALE_H__
+#define __GRAPHICS_SCALE_H__
+
+#include "graphics.h"
+
+bool scaler_init(scaler_t* scaler, scale_filter_t filter,
+    unsigned int factor);
+void scaler_destroy(scaler_t* scaler);
+const uint8_t* scaler_apply(scaler_t* scaler, const uint8_t* frame,
+    uint64_t hash);
+
+#endif//__GRAPHICS_SCALE_H__
@@ -13,24 +13,20 @@ typedef struct source {
     size_t x, y;
 } source_t;
 
-typedef struct map {
-    const memory_tile_map_t* tile_map;
-    const memory_tile_data_t* tile_data;
-    bool signed_ids;
-
-    size_t row, col;
-    size_t tile_x, tile_y;
-} map_t;
-
-void map_init(map_t* map, const memory_t* mem, tile_map_t tile_map,
-    size_t x, size_t y);
-
-void map_next(map_t* map, source_t* src);
-
 void draw_tile(dest_t* restrict dst, const source_t* restrict src,
     palette_t palette);
-void draw_tiles(dest_t* restrict dst, const map_t* restrict map,
-    palette_t palette);
+
+/*
+ * Color index of pixel x/y of a tile, x = 0 is the leftmost pixel.
+ */
+static inline uint8_t
+tile_pixel(const memory_tile_t* tile, size_t x, size_t y)
+{
+    const int shift = 7 - x;
+
+    return ((tile->lines[y][0] >> shift) & 1) |
+        (((tile->lines[y][1] >> shift) & 1) << 1);
+}
 
 void dest_init(dest_t* dst, SDL_Surface* surface, size_t x, size_t y, size_t num);
 void source_init(source_t *src, const memory_tile_t* tile, size_t x, size_t y);
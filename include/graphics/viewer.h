@@ -0,0 +1,31 @@
+#ifndef __GRAPHICS_VIEWER_H__
+#define __GRAPHICS_VIEWER_H__
+
+#include "graphics.h"
+
+// A window showing part of VRAM. Like a plane, it remembers what every
+// cell was drawn with and only redraws the cells that changed.
+struct viewer {
+    viewer_kind_t kind;
+    window_t      window;
+
+    // gfx->vram_version at the last update, 0 before the first one.
+    uint32_t      vram_version;
+
+    // VIEW_TILES: tile version each tile was drawn with.
+    uint32_t      tile_versions[MAX_TILES];
+
+    // VIEW_TILE_MAPS: tile and tile version each map entry was drawn
+    // with, and the addressing mode at the last update.
+    uint16_t      map_tiles[2][MAP_ROWS][MAP_COLUMNS];
+    uint32_t      map_versions[2][MAP_ROWS][MAP_COLUMNS];
+    bool          signed_ids;
+
+    // VIEW_OAM: tile and tile versions each sprite was drawn with, and
+    // the sprite height at the last update.
+    uint8_t       sprite_tiles[MAX_SPRITES];
+    uint32_t      sprite_versions[MAX_SPRITES][2];
+    size_t        sprite_height;
+};
+
+#endif//__GRAPHICS_VIEWER_H__
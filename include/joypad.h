@@ -5,8 +5,25 @@
 
 #include <SDL2/SDL.h>
 
+typedef struct input_event {
+    uint64_t     cycle;
+    joypad_key_t key;
+    bool         pressed;
+} input_event_t;
+
+// Key presses and releases waiting for their time, sorted by it. Events
+// before <next> have been applied already.
+typedef struct input_queue {
+    input_event_t* events;
+    size_t         len, capacity;
+    size_t         next;
+} input_queue_t;
+
 void joypad_init(context_t *ctx);
-void joypad_update(context_t *ctx);
+void joypad_destroy(context_t *ctx);
+void joypad_input_event(context_t *ctx, uint64_t time);
+void joypad_write(context_t *ctx, uint8_t value);
+void joypad_poll(context_t *ctx);
 void joypad_update_state(context_t *ctx, const SDL_KeyboardEvent *evt);
 
 #endif//__JOYPAD_H__
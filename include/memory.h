@@ -97,21 +97,8 @@ typedef struct memory_sound {
             sound_square_params_t square1;
             sound_square_params_t square2;
 
-            struct {
-                uint8_t BITFIELD(dac_on:1, :7);
-                uint8_t length_load;
-                uint8_t BITFIELD(:1, volume_code:2, :5);
-                uint8_t period_lsb;
-                uint8_t BITFIELD(trigger:1, length_enable:1, :3, period_msb:3);
-            } wave;
-            
-            struct {
-                uint8_t __pad0;
-                uint8_t BITFIELD(:2, length_load:6);
-                uint8_t BITFIELD(volume:4, envelope_mode:1, period:3);
-                uint8_t BITFIELD(clock_shift:4, lfsr_width:1, divisor_code:3);
-                uint8_t BITFIELD(trigger:1, length_enable:1, :6);
-            } noise;
+            sound_wave_params_t wave;
+            sound_noise_params_t noise;
             
             uint8_t BITFIELD(vin_l_enable:1, volume_left:3, vin_r_enable:1, volume_right:3);
             uint8_t BITFIELD(left_enables:4, right_enables:4);
@@ -0,0 +1,50 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spielbub.h"
+
+// Time of events that are not scheduled.
+#define EVENT_NEVER (UINT64_MAX)
+
+typedef enum event {
+    // Step of the APU frame sequencer, see sound_sequencer_event.
+    EVT_SEQUENCER,
+    // Overflow of TIMA, see timers_overflow_event.
+    EVT_TIMER,
+    // Timestamped key press or release, see joypad_queue.
+    EVT_INPUT,
+    EVT_COUNT
+} event_t;
+
+// Called with the time the event was due at, which may be a few cycles
+// before ctx->cycles.
+typedef void (*event_handler_f)(context_t *ctx, uint64_t time);
+
+// Events that have to happen at an exact cycle, instead of being polled
+// after every instruction. Each event has a single slot, scheduling it
+// again replaces its time.
+typedef struct scheduler {
+    // Due time of every event in ctx->cycles, or EVENT_NEVER.
+    uint64_t at[EVT_COUNT];
+
+    // The earliest of them.
+    uint64_t next;
+} scheduler_t;
+
+void scheduler_init(scheduler_t *sched);
+void scheduler_schedule(scheduler_t *sched, event_t event, uint64_t at);
+void scheduler_cancel(scheduler_t *sched, event_t event);
+void scheduler_run(context_t *ctx);
+
+/*
+ * Whether any event is due at <now>, cheap enough for every instruction.
+ */
+static inline bool scheduler_due(const scheduler_t *sched, uint64_t now)
+{
+    return now >= sched->next;
+}
+
+#endif//__SCHEDULER_H__
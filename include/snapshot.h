@@ -0,0 +1,62 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "context.h"
+
+/*
+ * The emulated state of a context, to go back to it later. Only what
+ * the game can observe is saved. Windows, devices, recordings and
+ * statistics belong to the host and are left alone, so restoring is
+ * only valid for the context the snapshot was taken of.
+ */
+typedef struct snapshot {
+    cpu_t        cpu;
+    memory_t     mem;
+    timers_t     timers;
+    scheduler_t  sched;
+    uint64_t     cycles;
+    unsigned int frame_cycles;
+
+    // Keys held, and how much of the queued input was applied to them.
+    // The events themselves stay queued, so nothing may be queued
+    // between saving and restoring.
+    uint8_t      joypad_state;
+    size_t       input_next;
+
+    // From gfx_t, see GFX_STATE.
+    struct {
+        fifo_t       fifo;
+        int          cycles;
+        int          window_y;
+        gfx_state_t  state;
+        int          next_line;
+        gfx_regs_t   regs;
+        gfx_write_t  writes[MAX_REGISTER_WRITES];
+        size_t       writes_len, writes_read;
+        uint32_t     vram_version;
+        uint32_t     tile_versions[MAX_TILES];
+        plane_t      planes[2];
+        bool         skip_frame, pooled;
+    } gfx;
+
+    // From sound_t, including the samples of the current frame.
+    struct {
+        sound_square_state_t square1, square2;
+        sound_wave_state_t   wave;
+        sound_noise_state_t  noise;
+        uint8_t              sequencer;
+        uint64_t             synced, frame_start;
+        blip_t               blips[SOUND_CHANNELS];
+        int32_t*             buffers[SOUND_CHANNELS];
+    } snd;
+} snapshot_t;
+
+snapshot_t* snapshot_create(const context_t *ctx);
+void snapshot_free(snapshot_t *snap);
+void snapshot_save(snapshot_t *snap, const context_t *ctx);
+void snapshot_restore(const snapshot_t *snap, context_t *ctx);
+
+#endif//__SNAPSHOT_H__
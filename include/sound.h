@@ -1,12 +1,16 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include <SDL2/SDL.h>
 
 #include "bitfield.h"
+#include "buffers.h"
+#include "sound/blip.h"
 
 typedef struct memory memory_t;
 typedef struct context context_t;
+typedef struct capture capture_t;
 
 typedef struct {
 	uint8_t BITFIELD(:1, sweep:3, negate:1, shift:3);
@@ -16,20 +20,118 @@ typedef struct {
     uint8_t BITFIELD(trigger:1, length_enable:1, :3, period_msb:3);
 } sound_square_params_t;
 
+typedef struct {
+    uint8_t __pad0;
+    uint8_t BITFIELD(:2, length_load:6);
+    uint8_t BITFIELD(volume:4, envelope_mode:1, period:3);
+    uint8_t BITFIELD(clock_shift:4, lfsr_width:1, divisor_code:3);
+    uint8_t BITFIELD(trigger:1, length_enable:1, :6);
+} sound_noise_params_t;
+
+typedef struct {
+    uint8_t BITFIELD(dac_on:1, :7);
+    uint8_t length_load;
+    uint8_t BITFIELD(:1, volume_code:2, :5);
+    uint8_t period_lsb;
+    uint8_t BITFIELD(trigger:1, length_enable:1, :3, period_msb:3);
+} sound_wave_params_t;
+
+#define SOUND_CHANNELS 4
+
 typedef struct {
 	uint16_t divider;
 	uint8_t wave_step;
 	uint8_t value;
 	uint8_t volume;
+
+    bool enabled;
+
+    // Clocked by the frame sequencer: remaining length, envelope timer
+    // and, for the first channel, the frequency sweep.
+    uint16_t length;
+    uint8_t envelope;
+    uint8_t sweep;
+    bool sweep_enabled;
+    uint16_t shadow;
 } sound_square_state_t;
 
+typedef struct {
+    uint16_t divider;
+    uint8_t position;
+    uint8_t value;
+
+    bool enabled;
+    uint16_t length;
+} sound_wave_state_t;
+
+typedef struct {
+    // Cycles until the LFSR is clocked next.
+    uint32_t divider;
+    uint16_t lfsr;
+    uint8_t value;
+    uint8_t volume;
+
+    bool enabled;
+    uint16_t length;
+    uint8_t envelope;
+} sound_noise_state_t;
+
 typedef struct {
 	SDL_AudioDeviceID device;
 	sound_square_state_t square1;
+	sound_square_state_t square2;
+    sound_wave_state_t wave;
+    sound_noise_state_t noise;
+
+    // Step of the frame sequencer that clocks lengths, envelopes and
+    // the sweep 512 times a second, see sound_sequencer_event.
+    uint8_t sequencer;
+
+    // ctx->cycles up to which the channels have been run, see sound_sync.
+    uint64_t synced;
+
+    // Output of each channel, and ctx->cycles at the start of their
+    // current frame. The channels are mixed at the end of the frame.
+    blip_t blips[SOUND_CHANNELS];
+    uint64_t frame_start;
+
+    // Samples on their way to the audio callback, if there is a device,
+    // and how many milliseconds of them may be queued.
+    ring_buffer *samples;
+    unsigned int latency_ms;
+
+    // Rate the channels are resampled to, steered so that the queue
+    // stays around the latency, and the smoothed fill of the queue.
+    unsigned int sample_rate;
+    size_t fill;
+
+    // Whether the device is unpaused, and the underruns it had then.
+    bool playing;
+    uint64_t seen_underruns;
+
+    // Where samples go instead of a device, if set.
+    capture_t *capture;
+
+    // Samples are thrown away while set, e.g. for frames that are run
+    // ahead and undone again.
+    bool muted;
+
+    // Frames that lost samples because too many were queued, resp.
+    // callbacks that ran out of samples.
+    uint64_t overruns;
+    atomic_uint_fast64_t underruns;
 } sound_t;
 
 uint8_t sound_read(const context_t *ctx, uint16_t addr);
 void sound_write(context_t *ctx, uint16_t addr, uint8_t value);
 bool sound_init(sound_t *snd);
-void sound_update(context_t *ctx, unsigned int cycles);
+bool sound_open_device(sound_t *snd);
+void sound_destroy(sound_t *snd);
+void sound_sync(context_t *ctx);
+void sound_schedule_sequencer(context_t *ctx);
+void sound_sequencer_event(context_t *ctx, uint64_t time);
+void sound_divider_reset(context_t *ctx, bool step);
+void sound_end_frame(context_t *ctx);
+void sound_run_square(sound_square_state_t *ch, const sound_square_params_t *params, unsigned int ticks, blip_t *blip, uint32_t time);
+void sound_run_noise(sound_noise_state_t *ch, const sound_noise_params_t *params, uint32_t cycles, blip_t *blip, uint32_t time);
 void sound_update_square(sound_square_state_t *ch, const sound_square_params_t *params);
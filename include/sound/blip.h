@@ -0,0 +1,47 @@
+#ifndef __SOUND_BLIP_H__
+#define __SOUND_BLIP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Sub-sample positions of a step, and the samples each step touches.
+#define BLIP_PHASE_BITS (6)
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_WIDTH (16)
+
+/*
+ * Band-limited synthesis buffer. Channels add amplitude changes at
+ * exact cycle times, the buffer turns them into band-limited steps at
+ * the output sample rate.
+ */
+typedef struct blip {
+    // Output samples per cycle, and the end of the current frame in
+    // samples. Both are 32.32 fixed point.
+    uint64_t factor;
+    uint64_t offset;
+
+    // Running sum of the buffer, i.e. the current output level.
+    int32_t  integrator;
+
+    // Band-limited impulses for every phase, each sums to 1 << 12.
+    int16_t  kernel[BLIP_PHASES][BLIP_WIDTH];
+
+    // Impulses of capacity samples, plus room for the last kernel.
+    size_t   capacity;
+    int32_t* buffer;
+} blip_t;
+
+bool blip_init(blip_t* blip, unsigned int clock_rate,
+    unsigned int sample_rate, size_t capacity);
+void blip_set_rates(blip_t* blip, unsigned int clock_rate,
+    unsigned int sample_rate);
+void blip_destroy(blip_t* blip);
+void blip_clear(blip_t* blip);
+void blip_add_delta(blip_t* blip, uint32_t time, int delta);
+void blip_end_frame(blip_t* blip, uint32_t time);
+size_t blip_samples_avail(const blip_t* blip);
+size_t blip_read_samples(blip_t* blip, int16_t* out, size_t count);
+void blip_discard(blip_t* blip, size_t count);
+
+#endif//__SOUND_BLIP_H__
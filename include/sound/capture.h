@@ -0,0 +1,36 @@
+#ifndef __SOUND_CAPTURE_H__
+#define __SOUND_CAPTURE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "spielbub.h"
+#include "writer.h"
+
+// Stereo frames per queued item.
+#define CAPTURE_BLOCK (1024)
+
+/*
+ * Writes the mixed output to a file instead of an audio device. Unlike
+ * frame recordings nothing is ever dropped, the emulator waits for the
+ * disk instead, so captures of the same run are identical.
+ */
+typedef struct capture {
+    writer_t*        writer;
+    capture_format_t format;
+
+    // Kept to fill in the sizes of the WAV header when closing.
+    char*            filename;
+    unsigned int     sample_rate;
+
+    // Stereo frames queued so far.
+    uint64_t         frames;
+} capture_t;
+
+capture_t* capture_open(const char* filename, capture_format_t format,
+    unsigned int sample_rate);
+void capture_push(capture_t* capture, const int16_t* samples, size_t frames);
+bool capture_close(capture_t* capture);
+
+#endif//__SOUND_CAPTURE_H__
@@ -0,0 +1,40 @@
+#ifndef __SOUND_LFSR_H__
+#define __SOUND_LFSR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Length of the 15 and 7 bit sequences. Every register value but zero
+// is part of them.
+#define LFSR_PERIOD_WIDE (0x7FFF)
+#define LFSR_PERIOD_NARROW (0x7F)
+
+/*
+ * Precomputed sequence of the noise channel's LFSR, in either width.
+ * Positions count clocks since the register was all ones.
+ */
+typedef struct lfsr_table {
+    // Length of the sequence, also the mask of the register bits that
+    // make up the state.
+    unsigned int    period;
+
+    // State at each position, and position of each state.
+    const uint16_t* values;
+    const uint16_t* positions;
+
+    // Bit 0 of the state at each position, for two periods in a row.
+    const uint64_t* bits;
+} lfsr_table_t;
+
+void lfsr_init(void);
+const lfsr_table_t* lfsr_table(bool narrow);
+uint16_t lfsr_clock(uint16_t lfsr, bool narrow);
+unsigned int lfsr_distance(const lfsr_table_t* table, unsigned int position);
+uint16_t lfsr_register(const lfsr_table_t* table, unsigned int position);
+
+static inline bool lfsr_bit(const lfsr_table_t* table, unsigned int position)
+{
+    return (table->bits[position / 64] >> (position % 64)) & 1;
+}
+
+#endif//__SOUND_LFSR_H__
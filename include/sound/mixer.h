@@ -0,0 +1,14 @@
+#ifndef __SOUND_MIXER_H__
+#define __SOUND_MIXER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sound.h"
+
+void mixer_mix(int16_t* restrict out,
+    const int16_t* const channels[SOUND_CHANNELS],
+    const int16_t left[SOUND_CHANNELS], const int16_t right[SOUND_CHANNELS],
+    size_t count);
+
+#endif//__SOUND_MIXER_H__
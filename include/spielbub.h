@@ -18,6 +18,7 @@
 
 typedef struct context context_t;
 typedef struct window window_t;
+typedef struct viewer viewer_t;
 typedef void (*update_func_t)(context_t*, void*);
 
 typedef enum emulation_state {
@@ -39,6 +40,75 @@ typedef enum graphics_layer {
     LAYER_SPRITES = 3
 } graphics_layer_t;
 
+typedef enum record_format {
+    // Y4M video with only a luma plane.
+    RECORD_Y4M,
+    // Headerless, four pixels per byte.
+    RECORD_2BPP,
+    // Concatenated binary PPM images.
+    RECORD_PPM
+} record_format_t;
+
+typedef enum capture_format {
+    // RIFF WAVE, 16 bit stereo.
+    CAPTURE_WAV,
+    // Headerless 16 bit little endian stereo samples.
+    CAPTURE_PCM
+} capture_format_t;
+
+typedef enum observation_format {
+    OBSERVE_NONE = 0,
+    // One byte per pixel, 0xFF is white.
+    OBSERVE_GREY,
+    // Color indexes, four pixels per byte.
+    OBSERVE_2BPP
+} observation_format_t;
+
+typedef enum scale_filter {
+    // Every pixel becomes a square of pixels.
+    SCALE_NEAREST,
+    // Scale2x resp. Scale3x, repeated for larger factors.
+    SCALE_SCALE2X,
+    // Rounds off diagonal edges, found by comparing the gradients along
+    // both diagonals. Doubles the size each time.
+    SCALE_EDGE
+} scale_filter_t;
+
+typedef enum ppu_backend {
+    // Draws whole lines at once, with fixed mode lengths.
+    PPU_FAST,
+    // Emulates the pixel FIFO dot by dot. Mode 3 gets longer with
+    // scrolling, the window and sprites, like on hardware.
+    PPU_ACCURATE
+} ppu_backend_t;
+
+typedef enum viewer_kind {
+    // All tiles in VRAM.
+    VIEW_TILES,
+    // Both tile maps, side by side.
+    VIEW_TILE_MAPS,
+    // The tiles of all sprites, in OAM order.
+    VIEW_OAM
+} viewer_kind_t;
+
+typedef struct present_stats {
+    uint64_t presented, dropped;
+    // Frames not presented because they were identical to the last one.
+    uint64_t unchanged;
+    // Time from finishing a frame to presenting it.
+    uint64_t latency_us, max_latency_us;
+} present_stats_t;
+
+typedef struct audio_stats {
+    // Frames that lost samples because the device didn't keep up, resp.
+    // times the device ran out of samples.
+    uint64_t overruns, underruns;
+    // Audio queued but not played yet.
+    unsigned int latency_ms;
+    // Rate the output is currently resampled to, see sound_end_frame.
+    unsigned int sample_rate;
+} audio_stats_t;
+
 typedef enum joypad_key {
     KEY_INVALID = 0,
     KEY_A = 1,
@@ -56,10 +126,17 @@ typedef struct registers {
 } registers_t;
 
 context_t* context_create(update_func_t func, void* context);
+context_t* context_create_headless(void);
 bool context_load_rom(context_t *ctx, const char* filename);
 void context_destroy(context_t *ctx);
 void context_quit(context_t* ctx);
 bool context_run(context_t* ctx);
+bool context_run_frames(context_t* ctx, unsigned int frames);
+bool context_set_run_ahead(context_t* ctx, unsigned int frames);
+unsigned int context_get_run_ahead(const context_t* ctx);
+
+const uint8_t* context_get_framebuffer(const context_t* ctx);
+uint64_t context_get_frame_hash(const context_t* ctx);
 
 size_t context_decode_instruction(const context_t* ctx, uint16_t addr,
     char dst[], size_t len);
@@ -81,11 +158,45 @@ bool context_get_traceback(const context_t* ctx, uint16_t* value);
 
 void joypad_press(context_t* ctx, joypad_key_t key);
 void joypad_release(context_t* ctx, joypad_key_t key);
+void joypad_set_late_polling(context_t* ctx, bool enabled);
+bool joypad_get_late_polling(const context_t* ctx);
+bool joypad_queue(context_t* ctx, uint64_t cycle, joypad_key_t key,
+    bool pressed);
+bool joypad_queue_frame(context_t* ctx, uint64_t frame, joypad_key_t key,
+    bool pressed);
 
 window_t* window_create(const char name[], int w, int h);
 void window_free(window_t* window);
 void window_draw(window_t* window);
 
+viewer_t* viewer_create(viewer_kind_t kind);
+void viewer_free(viewer_t* viewer);
+void viewer_update(viewer_t* viewer, const context_t* ctx);
+
+void graphics_set_backend(context_t* ctx, ppu_backend_t backend);
+void graphics_set_frame_skip(context_t* ctx, unsigned int frames);
+void graphics_get_frame_stats(const context_t* ctx, uint64_t* drawn,
+    uint64_t* skipped);
+void graphics_get_present_stats(const context_t* ctx, present_stats_t* stats);
+void graphics_set_vsync(context_t* ctx, bool enabled);
+bool graphics_get_vsync(const context_t* ctx);
+bool graphics_start_recording(context_t* ctx, const char* filename,
+    record_format_t format, unsigned int every);
+bool graphics_stop_recording(context_t* ctx);
+bool graphics_set_scale(context_t* ctx, scale_filter_t filter,
+    unsigned int factor);
+const uint8_t* graphics_get_scaled_frame(context_t* ctx, size_t* width,
+    size_t* height);
+bool graphics_set_observation(context_t* ctx, observation_format_t format,
+    size_t width, size_t height, bool max_pool);
+const uint8_t* graphics_get_observation(const context_t* ctx, size_t* len);
+
+void sound_set_latency(context_t* ctx, unsigned int ms);
+void sound_get_stats(const context_t* ctx, audio_stats_t* stats);
+bool sound_start_capture(context_t* ctx, const char* filename,
+    capture_format_t format, unsigned int sample_rate);
+bool sound_stop_capture(context_t* ctx);
+
 void graphics_toggle_debug(context_t* ctx, graphics_layer_t layer);
 bool graphics_get_debug(const context_t* ctx, graphics_layer_t layer);
 void graphics_draw_tile(const context_t* ctx, window_t* window,
@@ -5,11 +5,21 @@
 
 #define CLOCKSPEED (4194304)
 
+// DIV and TIMA are not counted, but derived from ctx->cycles whenever
+// they are read. Only TIMA overflows are events, see EVT_TIMER.
 typedef struct timers {
-    unsigned int divider_cycles;
-    unsigned int timer_cycles;
+    // ctx->cycles when the divider was last reset.
+    uint64_t divider_base;
+
+    // TIMA as of ctx->cycles timer_synced.
+    uint64_t timer_synced;
+    uint8_t tima;
 } timers_t;
 
-void timers_update(context_t *ctx, int cycles);
+void timers_init(context_t *ctx);
+uint16_t timers_divider(const context_t *ctx);
+uint8_t timers_read(const context_t *ctx, uint16_t addr);
+void timers_write(context_t *ctx, uint16_t addr, uint8_t value);
+void timers_overflow_event(context_t *ctx, uint64_t time);
 
 #endif//__TIMERS_H__
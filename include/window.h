@@ -1,9 +1,28 @@
 #ifndef __WINDOW_H__
 #define __WINDOW_H__
 
+#include <stdatomic.h>
 #include <SDL2/SDL.h>
 
 #include "spielbub.h"
+#include "buffers.h"
+
+#define FRAME_COLORS (16)
+
+// Key of the window_t in the SDL window's data.
+#define WINDOW_DATA "window_t"
+
+// A finished frame of color indexes, see window_t.colors.
+typedef struct frame {
+    uint8_t  pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+    // Hashes of each line and of the whole frame.
+    uint64_t line_hashes[SCREEN_HEIGHT];
+    uint64_t hash;
+
+    // SDL_GetPerformanceCounter() when the frame was finished.
+    uint64_t timestamp;
+} frame_t;
 
 struct window {
     SDL_Window   *window;
@@ -11,10 +30,45 @@ struct window {
     SDL_Texture  *texture;
     SDL_Surface  *surface;
     uint32_t      bg_color;
+
+    // Pixel values of the color indexes in a frame.
+    uint32_t      colors[FRAME_COLORS];
+
+    // Presents frames in the background, see window_start_thread.
+    SDL_Thread    *thread;
+    SDL_sem       *wakeup;
+    SDL_sem       *started;
+    triple_buffer *frames;
+    atomic_bool    quit;
+
+    // Updated by whoever presents frames.
+    atomic_uint_fast64_t presented, unchanged;
+    atomic_uint_fast64_t latency_us, max_latency_us;
+
+    // Requested by window_set_vsync, applied by whoever presents frames.
+    atomic_bool   vsync;
+    bool          vsync_enabled;
+
+    // Predicted refresh interval and upload time in performance counter
+    // ticks, see wait_for_upload.
+    uint64_t      last_present;
+    uint64_t      refresh_ticks, upload_ticks;
+
+    // Hashes of the frame on screen. Set <redraw> when the window's
+    // contents were lost, e.g. after it was exposed.
+    uint64_t      shown_hashes[SCREEN_HEIGHT];
+    uint64_t      shown_hash;
+    atomic_bool   redraw;
 };
 
 bool window_init(window_t* window, const char name[], int w, int h);
 void window_destroy(window_t* window);
 void window_clear(window_t *window);
+bool window_start_thread(window_t* window, triple_buffer* frames);
+void window_present(window_t* window, triple_buffer* frames);
+void window_set_vsync(window_t* window, bool enabled);
+void window_invalidate(window_t* window);
+bool window_dirty_lines(const window_t* window, const frame_t* frame,
+    SDL_Rect* dirty);
 
 #endif//__WINDOW_H__
@@ -0,0 +1,49 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <SDL2/SDL.h>
+
+#include "buffers.h"
+
+// Encodes a queued item into <dst>, returns the number of bytes written.
+typedef size_t (*writer_encode_t)(void* user, const uint8_t* item,
+    uint8_t* dst);
+
+/*
+ * Writes fixed size items to a file on a separate thread. Items are
+ * encoded and written in large batches there, the producer never waits
+ * for the disk.
+ */
+typedef struct writer {
+    int fd;
+
+    ring_buffer*    queue;
+    writer_encode_t encode;
+    size_t          max_encoded;
+    void*           user;
+
+    // Only touched by the writer thread.
+    uint8_t*        batch;
+    size_t          batch_len, batch_size;
+
+    SDL_Thread*     thread;
+    SDL_sem*        wakeup;
+    atomic_bool     quit, failed;
+
+    // Items that were written, resp. didn't fit into the queue.
+    atomic_uint_fast64_t written, dropped;
+} writer_t;
+
+writer_t* writer_open(const char* filename, const void* header,
+    size_t header_len, size_t item_len, size_t queue_len,
+    writer_encode_t encode, size_t max_encoded, void* user);
+uint8_t* writer_reserve(writer_t* writer);
+uint8_t* writer_reserve_wait(writer_t* writer);
+void writer_commit(writer_t* writer);
+bool writer_close(writer_t* writer);
+
+#endif//__WRITER_H__
@@ -48,7 +48,7 @@ solution "Spielbub"
    project "Spiellib"
       kind "StaticLib"
       language "C"
-      files { "src/*.h", "src/*.c", "src/graphics/*.c" }
+      files { "src/*.h", "src/*.c", "src/graphics/*.c", "src/sound/*.c" }
       
    project "sdltest"
       kind "ConsoleApp"
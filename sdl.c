@@ -1,5 +1,4 @@
 #include <SDL2/SDL.h>
-#include <math.h>
 #include <stdbool.h>
 
 #include "context.h"
@@ -7,8 +6,6 @@
 #include "sound.h"
 
 #define SAMPLE_RATE 44100
-#define CYCLES_PER_SAMPLE (CLOCKSPEED * 1.0 / SAMPLE_RATE)
-#define BUFFER_SIZE 4096
 #define AMPLITUDE 127
 #define FREQUENCY 440.0
 
@@ -18,49 +15,44 @@ int main() {
     const int waveform_cycles = 8; // one full waveform at max freq.
 
     context_t ctx;
-    if (!context_init_minimal(&ctx)) {
+    if (!context_init_minimal(&ctx, true)) {
         printf("unhappy\n");
         return 1;
     }
     
-    if (!sound_init(&ctx.snd)) {
+    if (!sound_open_device(&ctx.snd)) {
         printf("Sound failed\n");
         return 1;
     }
     
     // This is is what a ROM would do via CPU insns.
-    ctx.mem.sound.square1.period_lsb = 0x40;
-    ctx.mem.sound.square1.period_msb = 0x07;
-    ctx.mem.sound.square1.duty = 0b10;
-
-    // This is what the APU would do given a trigger.
-    ctx.snd.square1.divider = 0x740;
-    ctx.snd.square1.volume = 0b1111;
+    mem_write(&ctx, 0xFF26, 0x80); // NR52: power on
+    mem_write(&ctx, 0xFF24, 0x77); // NR50: full volume
+    mem_write(&ctx, 0xFF25, 0xFF); // NR51: all channels on both sides
+    mem_write(&ctx, 0xFF12, 0xF0); // NR12: volume 15, no envelope
+    mem_write(&ctx, 0xFF11, 0x80); // NR11: 50% duty
+    mem_write(&ctx, 0xFF13, 0x40); // NR13: period 0x740
+    mem_write(&ctx, 0xFF14, 0x87); // NR14: trigger, no length
     
     printf("Playing something\n");
     
-    double cycles = CYCLES_PER_SAMPLE;
-    uint8_t buffer[BUFFER_SIZE];
+    audio_stats_t stats;
+
     while (true) {
-        if (SDL_GetQueuedAudioSize(ctx.snd.device) >= SAMPLE_RATE/4) {
+        // Stay ahead of the device, but don't overrun the queue. Playing
+        // starts at the default latency of 50 ms.
+        sound_get_stats(&ctx, &stats);
+        if (stats.latency_ms >= 60) {
             SDL_Delay(5);
             continue;
         }
-        
-        for (unsigned int i = 0; i < sizeof(buffer); i++) {
-            sound_update(&ctx, cycles - fmod(cycles, 4));
-            buffer[i] = ctx.snd.square1.value;
 
-            cycles = CYCLES_PER_SAMPLE + fmod(cycles, 4);
-        }
-
-        if (SDL_QueueAudio(ctx.snd.device, buffer, sizeof(buffer)) != 0) {
-            fprintf(stderr, "Error queueing audio: %s\n", SDL_GetError());
-            break;
-        }
+        // Run the APU for a frame, its samples are queued at the end.
+        ctx.cycles += CYCLES_PER_FRAME;
+        sound_end_frame(&ctx);
     }
     
-    SDL_CloseAudioDevice(ctx.snd.device);
+    context_destroy_minimal(&ctx);
     SDL_Quit();
     return 0;
 }
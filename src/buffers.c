@@ -6,6 +6,8 @@
 #include "buffers.h"
 #include "logging.h"
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 /*
  * Initialize a circular buffer. Returned pointer must
  * be freed via cb_destroy(). Allocates room for <num> items
@@ -120,3 +122,227 @@ bool cb_read(circular_buffer* buf, uint8_t* dst)
     return (--buf->to_read >= 0);
 }
 
+
+#define TB_FRESH (4)
+#define TB_INDEX (3)
+
+/*
+ * Initialize a triple buffer of three <len> byte buffers. Returned
+ * pointer must be freed via tb_destroy().
+ */
+triple_buffer* tb_init(size_t len)
+{
+    // Keep every buffer suitably aligned for any type.
+    const size_t align = _Alignof(max_align_t);
+    const size_t header = (sizeof(triple_buffer) + align - 1) & ~(align - 1);
+
+    len = (len + align - 1) & ~(align - 1);
+
+    triple_buffer *tb = malloc(header + 3 * len);
+
+    if (tb == NULL) {
+        return NULL;
+    }
+
+    memset(tb, 0, header + 3 * len);
+
+    tb->buffer = (uint8_t*)tb + header;
+    tb->len    = len;
+    tb->back   = 0;
+    tb->latest = 1;
+    tb->front  = 2;
+    atomic_init(&tb->ready, 1);
+
+    return tb;
+}
+
+void tb_destroy(triple_buffer* tb)
+{
+    free(tb);
+}
+
+/*
+ * The buffer the producer is currently writing to.
+ */
+uint8_t* tb_back(triple_buffer* tb)
+{
+    return tb->buffer + tb->back * tb->len;
+}
+
+/*
+ * Makes the back buffer available to the consumer and returns a fresh
+ * back buffer. Returns true if the previously published buffer was
+ * never acquired, i.e. it has been dropped.
+ */
+bool tb_publish(triple_buffer* tb)
+{
+    unsigned int prev = atomic_exchange(&tb->ready, tb->back | TB_FRESH);
+    tb->latest = tb->back;
+    tb->back = prev & TB_INDEX;
+
+    return prev & TB_FRESH;
+}
+
+/*
+ * The most recently published buffer, as seen by the producer. Stays
+ * unchanged until the next call to tb_publish.
+ */
+const uint8_t* tb_latest(const triple_buffer* tb)
+{
+    return tb->buffer + tb->latest * tb->len;
+}
+
+/*
+ * Moves the most recently published buffer to the front, if there is a
+ * new one. Returns false if nothing has been published since the last
+ * call.
+ */
+bool tb_acquire(triple_buffer* tb)
+{
+    if (!(atomic_load(&tb->ready) & TB_FRESH)) {
+        return false;
+    }
+
+    unsigned int prev = atomic_exchange(&tb->ready, tb->front);
+    tb->front = prev & TB_INDEX;
+
+    return true;
+}
+
+/*
+ * The buffer the consumer is currently reading from.
+ */
+const uint8_t* tb_front(const triple_buffer* tb)
+{
+    return tb->buffer + tb->front * tb->len;
+}
+
+/*
+ * Initialize a queue of <num> items of <len> bytes. Returned pointer
+ * must be freed via rb_destroy(). Items are stored back to back, so
+ * they are as aligned as an object of <len> bytes has to be.
+ */
+ring_buffer* rb_init(size_t num, size_t len)
+{
+    const size_t align = _Alignof(max_align_t);
+    const size_t header = (sizeof(ring_buffer) + align - 1) & ~(align - 1);
+
+    ring_buffer *rb = malloc(header + num * len);
+
+    if (rb == NULL) {
+        return NULL;
+    }
+
+    memset(rb, 0, header + num * len);
+
+    rb->buffer = (uint8_t*)rb + header;
+    rb->len    = len;
+    rb->num    = num;
+    atomic_init(&rb->write, 0);
+    atomic_init(&rb->read, 0);
+
+    return rb;
+}
+
+void rb_destroy(ring_buffer* rb)
+{
+    free(rb);
+}
+
+/*
+ * The item the producer may fill next, or NULL if the queue is full.
+ * The item is only queued by rb_commit().
+ */
+uint8_t* rb_reserve(ring_buffer* rb)
+{
+    size_t write = atomic_load_explicit(&rb->write, memory_order_relaxed);
+
+    if (write - atomic_load(&rb->read) >= rb->num) {
+        return NULL;
+    }
+
+    return rb->buffer + (write % rb->num) * rb->len;
+}
+
+void rb_commit(ring_buffer* rb)
+{
+    atomic_fetch_add(&rb->write, 1);
+}
+
+/*
+ * The oldest queued item, or NULL if the queue is empty. The item stays
+ * queued until rb_release().
+ */
+const uint8_t* rb_peek(ring_buffer* rb)
+{
+    size_t read = atomic_load_explicit(&rb->read, memory_order_relaxed);
+
+    if (read == atomic_load(&rb->write)) {
+        return NULL;
+    }
+
+    return rb->buffer + (read % rb->num) * rb->len;
+}
+
+void rb_release(ring_buffer* rb)
+{
+    atomic_fetch_add(&rb->read, 1);
+}
+
+size_t rb_used(ring_buffer* rb)
+{
+    return atomic_load(&rb->write) - atomic_load(&rb->read);
+}
+
+/*
+ * Copies <count> items between <items> and the queue, starting at
+ * position <pos>. Wraps around at the end of the queue.
+ */
+static void rb_copy(ring_buffer* rb, size_t pos, uint8_t* items,
+    size_t count, bool to_queue)
+{
+    const size_t first = MIN(count, rb->num - pos % rb->num);
+    const size_t sizes[] = { first * rb->len, (count - first) * rb->len };
+    uint8_t* queue[] = { rb->buffer + (pos % rb->num) * rb->len, rb->buffer };
+
+    for (size_t i = 0; i < 2; i++) {
+        if (to_queue) {
+            memcpy(queue[i], items, sizes[i]);
+        } else {
+            memcpy(items, queue[i], sizes[i]);
+        }
+
+        items += sizes[i];
+    }
+}
+
+/*
+ * Queues up to <count> items from <src> at once, returns how many fit.
+ */
+size_t rb_write(ring_buffer* rb, const void* src, size_t count)
+{
+    size_t write = atomic_load_explicit(&rb->write, memory_order_relaxed);
+    size_t room = rb->num - (write - atomic_load(&rb->read));
+
+    count = MIN(count, room);
+    rb_copy(rb, write, (uint8_t*)src, count, true);
+    atomic_fetch_add(&rb->write, count);
+
+    return count;
+}
+
+/*
+ * Dequeues up to <count> items into <dst> at once, returns how many
+ * there were.
+ */
+size_t rb_read(ring_buffer* rb, void* dst, size_t count)
+{
+    size_t read = atomic_load_explicit(&rb->read, memory_order_relaxed);
+    size_t used = atomic_load(&rb->write) - read;
+
+    count = MIN(count, used);
+    rb_copy(rb, read, dst, count, false);
+    atomic_fetch_add(&rb->read, count);
+
+    return count;
+}
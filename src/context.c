@@ -2,22 +2,33 @@
 
 #include "context.h"
 #include "joypad.h"
+#include "snapshot.h"
 
 #include "logging.h"
 #include "meta.h"
 
 static unsigned int current_instances = 0;
 
-bool context_init_minimal(context_t *ctx)
+bool context_init_minimal(context_t *ctx, bool headless)
 {
     memset(ctx, 0, sizeof(context_t));
 
+    ctx->headless = headless;
+
     cpu_init(&ctx->cpu);
     mem_init(&ctx->mem);
+    scheduler_init(&ctx->sched);
+    timers_init(ctx);
 
-    if (!graphics_init(&ctx->gfx)) {
+    if (!graphics_init(&ctx->gfx, headless)) {
+        return false;
+    }
+
+    if (!sound_init(&ctx->snd)) {
         return false;
     }
+
+    sound_schedule_sequencer(ctx);
     
 #if defined(DEBUG)
     ctx->logs = cb_init(LOG_NUM, LOG_LEN);
@@ -36,8 +47,8 @@ bool context_init_minimal(context_t *ctx)
 
 context_t* context_create(update_func_t func, void* context)
 {
-    if (current_instances++ != 0) {
-        goto error;
+    if (current_instances != 0) {
+        return NULL;
     }
 
     context_t *ctx = malloc(sizeof(context_t));
@@ -48,14 +59,17 @@ context_t* context_create(update_func_t func, void* context)
 
     if (SDL_Init(0) < 0)
     {
-        goto error;
+        free(ctx);
+        return NULL;
     }
 
-    if (!context_init_minimal(ctx)) {
+    current_instances++;
+
+    if (!context_init_minimal(ctx, false)) {
         goto error;
     }
 
-    if (!sound_init(&ctx->snd)) {
+    if (!sound_open_device(&ctx->snd)) {
         goto error;
     }
 
@@ -69,26 +83,63 @@ context_t* context_create(update_func_t func, void* context)
     return ctx;
 
     error: {
+        // The window and its presenter thread might be running already.
+        context_destroy(ctx);
+        return NULL;
+    }
+}
+
+/*
+ * Creates a context without window, sound or input, for running
+ * emulation as fast as possible with context_run_frames. Unlike
+ * context_create, any number of these can exist at the same time.
+ */
+context_t* context_create_headless(void)
+{
+    context_t *ctx = malloc(sizeof(context_t));
+
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (!context_init_minimal(ctx, true)) {
+        // Frees whatever was set up before the failure.
+        context_destroy_minimal(ctx);
         free(ctx);
         return NULL;
     }
+
+    joypad_init(ctx);
+    ctx->state = RUNNING;
+
+    return ctx;
 }
 
-void context_destroy(context_t *ctx)
+void context_destroy_minimal(context_t *ctx)
 {
-    if (ctx != NULL) {
-        mem_destroy(&ctx->mem);
+    mem_destroy(&ctx->mem);
 
 #if defined(DEBUG)
-        cb_destroy(ctx->logs);
-        cb_destroy(ctx->traceback);
-        set_init(&ctx->breakpoints);
+    cb_destroy(ctx->logs);
+    cb_destroy(ctx->traceback);
+    set_init(&ctx->breakpoints);
 #endif
 
-        graphics_destroy(&ctx->gfx);
+    graphics_destroy(&ctx->gfx);
+    sound_destroy(&ctx->snd);
+    joypad_destroy(ctx);
+    snapshot_free(ctx->snapshot);
+}
+
+void context_destroy(context_t *ctx)
+{
+    if (ctx != NULL) {
+        context_destroy_minimal(ctx);
 
-        --current_instances;
-        SDL_Quit();
+        if (!ctx->headless) {
+            --current_instances;
+            SDL_Quit();
+        }
 
         free(ctx);
     }
@@ -99,56 +150,173 @@ bool context_load_rom(context_t *ctx, const char* filename)
     return mem_load_rom(&ctx->mem, filename);
 }
 
-bool context_run(context_t* ctx)
+/*
+ * Executes instructions until a frame's worth of cycles has passed or
+ * execution is stopped. Returns true if the frame was finished.
+ */
+static bool run_frame(context_t* ctx)
 {
-    SDL_Event event;
-    unsigned int cycles_frame = 0;
+    while (ctx->state == RUNNING) {
+        int cycles;
 
-    ctx->next_run = SDL_GetTicks64() + TICKS_PER_FRAME;
-    ctx->running = true;
+#if defined(DEBUG)
+        cb_write(ctx->traceback, &ctx->cpu.PC);
+#endif
 
-    while (ctx->running)
-    {
-        while (ctx->state == RUNNING) {
-            int cycles;
+        if (ctx->cpu.IME) {
+            // Interrupt Master Enable
+            cpu_interrupts(ctx);
+        }
+
+        if (ctx->cpu.halted) {
+            cycles = 4;
+        } else {
+            cycles = cpu_run(ctx);
+        }
+
+        // Update graphics. Timers follow ctx->cycles by themselves,
+        // and the joypad only changes on writes and key events.
+        graphics_update(ctx, cycles);
 
 #if defined(DEBUG)
-            cb_write(ctx->traceback, &ctx->cpu.PC);
+        if (ctx->stopflags & STOP_STEP)
+        {
+            ctx->state = SINGLE_STEPPED;
+            ctx->stopflags &= ~STOP_STEP;
+        } else if (set_contains(&ctx->breakpoints, ctx->cpu.PC)) {
+            ctx->state = BREAKPOINT;
+        }
 #endif
 
-            if (ctx->cpu.IME) {
-                // Interrupt Master Enable
-                cpu_interrupts(ctx);
-            }
+        ctx->cycles += cycles;
+        ctx->frame_cycles += cycles;
 
-            if (ctx->cpu.halted) {
-                cycles = 4;
-            } else {
-                cycles = cpu_run(ctx);
-            }
+        if (scheduler_due(&ctx->sched, ctx->cycles)) {
+            scheduler_run(ctx);
+        }
+
+        if (ctx->frame_cycles >= CYCLES_PER_FRAME) {
+            ctx->frame_cycles -= CYCLES_PER_FRAME;
+            sound_end_frame(ctx);
+            return true;
+        }
+    }
+
+    return false;
+}
 
-            // Update graphics, timers, etc.
-            timers_update(ctx, cycles);
-            graphics_update(ctx, cycles);
-            sound_update(ctx, cycles);
-            joypad_update(ctx);
+/*
+ * Runs a frame, then ctx->run_ahead more that are undone again. Only the
+ * last of those is shown, and only the first, kept one is heard. Games
+ * that react to input a few frames late seem to react that much sooner.
+ */
+bool context_run_frame_ahead(context_t* ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
 
 #if defined(DEBUG)
-            if (ctx->stopflags & STOP_STEP)
-            {
-                ctx->state = SINGLE_STEPPED;
-                ctx->stopflags &= ~STOP_STEP;
-            } else if (set_contains(&ctx->breakpoints, ctx->cpu.PC)) {
-                ctx->state = BREAKPOINT;
-            }
+    // Stepping and breakpoints would stop in frames that are undone.
+    if (ctx->stopflags != 0 || ctx->breakpoints.length > 0) {
+        return run_frame(ctx);
+    }
 #endif
 
-            cycles_frame += cycles;
-            if (cycles_frame >= CYCLES_PER_FRAME) {
-                cycles_frame -= CYCLES_PER_FRAME;
-                break;
-            }
-        }
+    if (ctx->run_ahead == 0) {
+        return run_frame(ctx);
+    }
+
+    // The kept frame is superseded by the one ahead, no need to draw it.
+    gfx->hidden = true;
+
+    if (!run_frame(ctx)) {
+        gfx->hidden = false;
+        return false;
+    }
+
+    snapshot_save(ctx->snapshot, ctx);
+    ctx->snd.muted = true;
+
+    const uint64_t drawn = gfx->frames_drawn;
+
+    for (unsigned int i = 1; i <= ctx->run_ahead; i++) {
+        // Only the frame that starts during the last one is drawn.
+        gfx->hidden = i < ctx->run_ahead;
+        run_frame(ctx);
+    }
+
+    // Depending on where LY is at the end of a frame, the drawn frame
+    // might only end during the next one.
+    if (gfx->frames_drawn == drawn) {
+        gfx->hidden = true;
+        run_frame(ctx);
+    }
+
+    snapshot_restore(ctx->snapshot, ctx);
+    ctx->snd.muted = false;
+    gfx->hidden = false;
+
+    return true;
+}
+
+// Frames this late are not caught up on, the schedule starts over.
+#define MAX_FRAMES_BEHIND (3)
+
+/*
+ * Moves ctx->next_run on by the length of a frame, in ticks of a counter
+ * running at <freq>. Frames don't last a whole number of ticks, the rest
+ * is carried over so that they add up exactly.
+ */
+void context_advance_next_run(context_t* ctx, uint64_t freq)
+{
+    ctx->next_run += freq * CYCLES_PER_FRAME / CLOCKSPEED;
+    ctx->next_run_fraction += freq * CYCLES_PER_FRAME % CLOCKSPEED;
+
+    if (ctx->next_run_fraction >= CLOCKSPEED) {
+        ctx->next_run_fraction -= CLOCKSPEED;
+        ctx->next_run++;
+    }
+}
+
+/*
+ * Sleeps until the next frame is due. Frames are due at fixed points of
+ * the performance counter, so neither sleeping too long nor rounding
+ * the frame length makes the emulator drift. SDL_Delay can oversleep,
+ * so the last millisecond is waited out by yielding instead.
+ */
+static void pace_frame(context_t* ctx)
+{
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t ticks = freq * CYCLES_PER_FRAME / CLOCKSPEED;
+    const uint64_t margin = freq / 1000;
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (now > ctx->next_run + MAX_FRAMES_BEHIND * ticks) {
+        ctx->next_run = now;
+        ctx->next_run_fraction = 0;
+    }
+
+    if (ctx->next_run > now + margin) {
+        SDL_Delay((ctx->next_run - now - margin) * 1000 / freq);
+    }
+
+    while (SDL_GetPerformanceCounter() < ctx->next_run) {
+        SDL_Delay(0);
+    }
+
+    context_advance_next_run(ctx, freq);
+}
+
+bool context_run(context_t* ctx)
+{
+    SDL_Event event;
+
+    ctx->next_run = SDL_GetPerformanceCounter();
+    ctx->next_run_fraction = 0;
+    ctx->running = true;
+
+    while (ctx->running)
+    {
+        context_run_frame_ahead(ctx);
 
         while (SDL_PollEvent(&event))
         {
@@ -160,8 +328,23 @@ bool context_run(context_t* ctx)
                     return true;
                 }
                 
-                // Update current joypad state
-                joypad_update_state(ctx, &(event.key));
+                // Update current joypad state, unless it is polled.
+                if (!ctx->late_polling) {
+                    joypad_update_state(ctx, &(event.key));
+                }
+            }
+            else if (event.type == SDL_WINDOWEVENT &&
+                (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                 event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+            {
+                // Unchanged frames are not presented, so the window has
+                // to be redrawn explicitly. Debugger windows, too.
+                window_t* window = SDL_GetWindowData(
+                    SDL_GetWindowFromID(event.window.windowID), WINDOW_DATA);
+
+                if (window != NULL) {
+                    window_invalidate(window);
+                }
             }
             else if (event.type == SDL_QUIT)
             {
@@ -169,21 +352,81 @@ bool context_run(context_t* ctx)
             }
         }
 
+        // Also poll between frames, for games that didn't read the keys.
+        if (ctx->late_polling) {
+            joypad_poll(ctx);
+        }
+
         if (ctx->update_func != NULL) {
             ctx->update_func(ctx, ctx->update_func_context);
         }
 
-        uint64_t now = SDL_GetTicks64();
-        if (now < ctx->next_run) {
-            SDL_Delay(ctx->next_run - now);
+        pace_frame(ctx);
+    }
+
+    return true;
+}
+
+/*
+ * Runs <frames> frames without pacing or handling any events. Returns
+ * false if execution stopped early, e.g. on a breakpoint.
+ */
+bool context_run_frames(context_t* ctx, unsigned int frames)
+{
+    for (; frames > 0; frames--) {
+        if (!run_frame(ctx)) {
+            return false;
         }
+    }
+
+    return true;
+}
+
+/*
+ * The last frame that was drawn, as SCREEN_HEIGHT rows of SCREEN_WIDTH
+ * color indexes: 0 is white, 3 is black. Stays valid until the next
+ * frame is drawn.
+ */
+const uint8_t* context_get_framebuffer(const context_t* ctx)
+{
+    const frame_t* frame = (const frame_t*)tb_latest(ctx->gfx.frames);
+    return &frame->pixels[0][0];
+}
+
+/*
+ * Hash of the frame returned by context_get_framebuffer. It is computed
+ * while the frame is drawn.
+ */
+uint64_t context_get_frame_hash(const context_t* ctx)
+{
+    const frame_t* frame = (const frame_t*)tb_latest(ctx->gfx.frames);
+    return frame->hash;
+}
+
+/*
+ * Runs <frames> frames ahead of the emulated one and shows the last of
+ * them, see context_run_frame_ahead. 0 turns this off. Only applies to
+ * context_run, context_run_frames runs every frame as it is.
+ */
+bool context_set_run_ahead(context_t* ctx, unsigned int frames)
+{
+    if (frames > 0 && ctx->snapshot == NULL) {
+        ctx->snapshot = snapshot_create(ctx);
 
-        ctx->next_run += TICKS_PER_FRAME;
+        if (ctx->snapshot == NULL) {
+            return false;
+        }
     }
 
+    ctx->run_ahead = frames;
     return true;
 }
 
+unsigned int context_get_run_ahead(const context_t* ctx)
+{
+    return ctx->run_ahead;
+}
+
 void context_quit(context_t* ctx)
 {
     ctx->running = false;
@@ -1,11 +1,11 @@
 #include <stdio.h>
 #include <stddef.h>
+#include <inttypes.h>
 #include <string.h>
 
 #include "debugger/commands.h"
 
 #define NUM(x) (sizeof(x) / sizeof(x[0]))
-#define CEIL(a, b) ((a + (b - 1)) / b)
 
 static void exec_next(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_pause(const char* args, context_t* ctx, debug_t* dbg);
@@ -19,9 +19,16 @@ static void exec_traceback(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_print(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_registers(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_viewtiles(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_viewmaps(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_viewoam(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_layer(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_press(const char* args, context_t* ctx, debug_t* dbg);
 static void exec_release(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_stats(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_vsync(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_ppu(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_latepoll(const char* args, context_t* ctx, debug_t* dbg);
+static void exec_runahead(const char* args, context_t* ctx, debug_t* dbg);
 
 static const struct {
     command_t handler;
@@ -39,9 +46,16 @@ static const struct {
     { &exec_print, "print" },
     { &exec_registers, "registers" },
     { &exec_viewtiles, "viewtiles" },
+    { &exec_viewmaps, "viewmaps" },
+    { &exec_viewoam, "viewoam" },
     { &exec_layer, "layer" },
     { &exec_press, "press" },
-    { &exec_release, "release" }
+    { &exec_release, "release" },
+    { &exec_stats, "stats" },
+    { &exec_vsync, "vsync" },
+    { &exec_ppu, "ppu" },
+    { &exec_latepoll, "latepoll" },
+    { &exec_runahead, "runahead" }
 };
 
 bool execute_command(const char* command, context_t* ctx, debug_t* dbg)
@@ -248,25 +262,26 @@ static void exec_viewtiles(const char* args, context_t* ctx, debug_t* dbg)
     (void)args;
     (void)ctx;
 
-    if (!dbg->show_tiles) {
-        dbg->window = window_create(
-            "Tiles",
-            (DBG_TILES_PER_ROW) * (TILE_WIDTH + 1),
-            CEIL(MAX_TILES, DBG_TILES_PER_ROW) * (TILE_HEIGHT + 1)
-        );
+    debug_toggle_viewer(dbg, VIEW_TILES);
+    printf("Toggling tile view.\n");
+}
 
-        if (dbg->window == NULL) {
-            printf("Failed to create window\n");
-            return;
-        }
-    } else {
-        window_free(dbg->window);
-        dbg->window = NULL;
-    }
+static void exec_viewmaps(const char* args, context_t* ctx, debug_t* dbg)
+{
+    (void)args;
+    (void)ctx;
 
-    dbg->show_tiles = !dbg->show_tiles;
-    
-    printf("Toggling tile view.\n");
+    debug_toggle_viewer(dbg, VIEW_TILE_MAPS);
+    printf("Toggling tile map view.\n");
+}
+
+static void exec_viewoam(const char* args, context_t* ctx, debug_t* dbg)
+{
+    (void)args;
+    (void)ctx;
+
+    debug_toggle_viewer(dbg, VIEW_OAM);
+    printf("Toggling OAM view.\n");
 }
 
 static void exec_layer(const char* args, context_t* ctx, debug_t* dbg)
@@ -370,3 +385,79 @@ static void exec_release(const char* args, context_t* ctx, debug_t* dbg)
         joypad_release(ctx, key);
     }
 }
+
+static void exec_stats(const char* args, context_t* ctx, debug_t* dbg)
+{
+    present_stats_t stats;
+    uint64_t drawn, skipped;
+
+    (void)args;
+    (void)dbg;
+
+    graphics_get_frame_stats(ctx, &drawn, &skipped);
+    graphics_get_present_stats(ctx, &stats);
+
+    printf("   Frames: %" PRIu64 " drawn, %" PRIu64 " skipped\n", drawn, skipped);
+    printf("   Presented: %" PRIu64 ", dropped: %" PRIu64
+        ", unchanged: %" PRIu64 "\n",
+        stats.presented, stats.dropped, stats.unchanged);
+    printf("   Latency: %" PRIu64 " us, max %" PRIu64 " us\n",
+        stats.latency_us, stats.max_latency_us);
+}
+
+static void exec_vsync(const char* args, context_t* ctx, debug_t* dbg)
+{
+    (void)args;
+    (void)dbg;
+
+    graphics_set_vsync(ctx, !graphics_get_vsync(ctx));
+    printf("Vsync %s.\n", graphics_get_vsync(ctx) ? "enabled" : "disabled");
+}
+
+static void exec_ppu(const char* args, context_t* ctx, debug_t* dbg)
+{
+    size_t arglen = strlen(args);
+
+    (void)dbg;
+
+    if (arglen > 0 && strncmp("fast", args, arglen) == 0) {
+        graphics_set_backend(ctx, PPU_FAST);
+    } else if (arglen > 0 && strncmp("accurate", args, arglen) == 0) {
+        graphics_set_backend(ctx, PPU_ACCURATE);
+    } else {
+        printf("Usage: ppu fast|accurate\n");
+        return;
+    }
+
+    printf("Switched PPU backend, the frame starts over.\n");
+}
+
+static void exec_latepoll(const char* args, context_t* ctx, debug_t* dbg)
+{
+    (void)args;
+    (void)dbg;
+
+    joypad_set_late_polling(ctx, !joypad_get_late_polling(ctx));
+    printf("Late input polling %s.\n",
+        joypad_get_late_polling(ctx) ? "enabled" : "disabled");
+}
+
+static void exec_runahead(const char* args, context_t* ctx, debug_t* dbg)
+{
+    unsigned int frames;
+
+    (void)dbg;
+
+    if (sscanf(args, "%u", &frames) != 1) {
+        printf("Running %u frames ahead.\n", context_get_run_ahead(ctx));
+        printf("Usage: runahead <frames>\n");
+        return;
+    }
+
+    if (!context_set_run_ahead(ctx, frames)) {
+        printf("Could not allocate a snapshot.\n");
+        return;
+    }
+
+    printf("Running %u frames ahead.\n", frames);
+}
@@ -3,29 +3,51 @@
 
 #include "debugger/debug.h"
 
+#define NUM(x) (sizeof(x) / sizeof(x[0]))
+
 bool debug_init(debug_t* dbg)
 {
     memset(dbg->commandline, 0, sizeof dbg->commandline);
+    memset(dbg->viewers, 0, sizeof dbg->viewers);
     return true;
 }
 
 void debug_free(debug_t *dbg)
 {
-    if (dbg->window != NULL) {
-        window_free(dbg->window);
+    for (size_t i = 0; i < NUM(dbg->viewers); i++) {
+        viewer_free(dbg->viewers[i]);
     }
 }
 
-void debug_draw_tiles(const context_t* ctx, debug_t* dbg)
+/*
+ * Opens or closes a viewer.
+ */
+void debug_toggle_viewer(debug_t* dbg, viewer_kind_t kind)
 {
-    for (size_t i = 0; i < MAX_TILES; i++) {
-        size_t x = (i % DBG_TILES_PER_ROW) * (TILE_WIDTH + 1);
-        size_t y = (i / DBG_TILES_PER_ROW) * (TILE_HEIGHT + 1);
+    if (dbg->viewers[kind] != NULL) {
+        viewer_free(dbg->viewers[kind]);
+        dbg->viewers[kind] = NULL;
+        return;
+    }
+
+    dbg->viewers[kind] = viewer_create(kind);
 
-        graphics_draw_tile(ctx, dbg->window, i, x, y);
+    if (dbg->viewers[kind] == NULL) {
+        printf("Failed to create window\n");
     }
+}
 
-    window_draw(dbg->window);
+/*
+ * Brings open viewers up to date. Only what changed is redrawn, so this
+ * is cheap enough to do every frame.
+ */
+void debug_update_viewers(const context_t* ctx, debug_t* dbg)
+{
+    for (size_t i = 0; i < NUM(dbg->viewers); i++) {
+        if (dbg->viewers[i] != NULL) {
+            viewer_update(dbg->viewers[i], ctx);
+        }
+    }
 }
 
 void debug_print_func(const context_t* ctx, uint16_t addr)
@@ -63,9 +63,7 @@ void update(context_t* ctx, debug_t *dbg)
 
     state = context_get_exec(ctx);
 
-    if (dbg->show_tiles) {
-        debug_draw_tiles(ctx, dbg);
-    }
+    debug_update_viewers(ctx, dbg);
 }
 
 int main(int argc, const char* argv[])
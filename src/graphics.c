@@ -4,7 +4,12 @@
 
 #include "ioregs.h"
 #include "logging.h"
+#include "murmur3.h"
 #include "graphics/tiles.h"
+#include "graphics/planes.h"
+#include "graphics/observe.h"
+#include "graphics/record.h"
+#include "graphics/scale.h"
 
 #define NUM(x) (sizeof x / sizeof x[0])
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -17,9 +22,34 @@ static const SDL_Color sdl_palette[] = {
     {0x00, 0x00, 0x00, 0xFF}, // Black
 };
 
-/* BIG MESS, you have been warned */
+// Colors of frame_t pixels. Layers drawn in debug mode use the colors
+// at 4 * layer + shade, shade 0 is always transparent.
+static const SDL_Color frame_colors[FRAME_COLORS] = {
+    {0xFF, 0xFF, 0xFF, 0xFF}, // White
+    {0xCC, 0xCC, 0xCC, 0xFF}, // Light grey
+    {0x77, 0x77, 0x77, 0xFF}, // Dark grey
+    {0x00, 0x00, 0x00, 0xFF}, // Black
+
+    // LAYER_BACKGROUND
+    {0x00, 0x00, 0x00, 0x00},
+    {0xD8, 0x8A, 0xDC, 0xFF},
+    {0x9E, 0x51, 0xA3, 0xFF},
+    {0x4D, 0x00, 0x52, 0xFF},
+
+    // LAYER_WINDOW
+    {0x00, 0x00, 0x00, 0x00},
+    {0x8A, 0xDC, 0x90, 0xFF},
+    {0x51, 0xA3, 0x57, 0xFF},
+    {0x00, 0x52, 0x06, 0xFF},
+
+    // LAYER_SPRITES
+    {0x00, 0x00, 0x00, 0x00},
+    {0x8A, 0xDC, 0xD8, 0xFF},
+    {0x51, 0xA3, 0x9E, 0xFF},
+    {0x00, 0x52, 0x4D, 0xFF},
+};
 
-void draw_line(context_t *ctx);
+void draw_line(context_t *ctx, uint8_t screen_y);
 
 SDL_Surface* create_surface(void) {
     SDL_Surface *surface = SDL_CreateRGBSurface(
@@ -42,16 +72,44 @@ SDL_Surface* create_surface(void) {
     return surface;
 }
 
-bool graphics_init(gfx_t* gfx)
+static void frame_hash_line(frame_t* frame, size_t y)
+{
+    uint64_t hash[2];
+
+    MurmurHash3_x64_128(frame->pixels[y], SCREEN_WIDTH, 0, hash);
+    frame->line_hashes[y] = hash[0];
+}
+
+static void frame_hash(frame_t* frame)
+{
+    uint64_t hash[2];
+
+    MurmurHash3_x64_128(frame->line_hashes, sizeof frame->line_hashes, 0,
+        hash);
+    frame->hash = hash[0];
+}
+
+/*
+ * Sets up the PPU. A <headless> PPU has no window, finished frames are
+ * only available through context_get_framebuffer.
+ */
+bool graphics_init(gfx_t* gfx, bool headless)
 {
     memset(gfx, 0, sizeof *gfx);
 
-    if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) {
-        return false;
-    }
+    gfx->headless = headless;
 
-    if (!window_init(&gfx->window, "Spielbub", SCREEN_WIDTH, SCREEN_HEIGHT)) {
-        return false;
+    if (!headless) {
+        if (SDL_InitSubSystem(SDL_INIT_VIDEO) < 0) {
+            return false;
+        }
+
+        if (!window_init(&gfx->window, "Spielbub", SCREEN_WIDTH,
+            SCREEN_HEIGHT))
+        {
+            SDL_QuitSubSystem(SDL_INIT_VIDEO);
+            return false;
+        }
     }
 
     gfx->background = create_surface();
@@ -66,9 +124,43 @@ bool graphics_init(gfx_t* gfx)
     gfx->layers[1] = gfx->sprites_bg;
     gfx->layers[2] = gfx->sprites_fg;
     gfx->state = OAM;
+    gfx->backend = &gfx_fast_backend;
+    scaler_init(&gfx->scaler, SCALE_NEAREST, 1);
+
+    gfx->frames = tb_init(sizeof(frame_t));
+
+    if (gfx->frames == NULL) {
+        goto error;
+    }
+
+    // Planes start out stale.
+    gfx->vram_version = 1;
+    plane_invalidate(&gfx->planes[TILE_MAP_LOW]);
+    plane_invalidate(&gfx->planes[TILE_MAP_HIGH]);
+
+    // Start out with a blank screen.
+    frame_t *frame = (frame_t*)tb_back(gfx->frames);
 
-    window_clear(&gfx->window);
-    window_draw(&gfx->window);
+    for (size_t y = 0; y < SCREEN_HEIGHT; y++) {
+        frame_hash_line(frame, y);
+    }
+    frame_hash(frame);
+    tb_publish(gfx->frames);
+
+    if (headless) {
+        return true;
+    }
+
+    graphics_map_colors(&gfx->window);
+    window_present(&gfx->window, gfx->frames);
+
+#if !defined(__APPLE__)
+    // macOS only allows rendering on the main thread, frames are
+    // presented synchronously there.
+    if (!window_start_thread(&gfx->window, gfx->frames)) {
+        goto error;
+    }
+#endif
 
     return true;
 
@@ -78,11 +170,35 @@ bool graphics_init(gfx_t* gfx)
     }
 }
 
+/*
+ * Sets up the pixel values of the frame colors for <window>.
+ */
+void graphics_map_colors(window_t *window)
+{
+    for (size_t i = 0; i < NUM(frame_colors); i++) {
+        window->colors[i] = SDL_MapRGB(window->surface->format,
+            frame_colors[i].r, frame_colors[i].g, frame_colors[i].b);
+    }
+}
+
 void graphics_destroy(gfx_t *gfx)
 {
     if (gfx != NULL) {
+        if (gfx->recorder != NULL) {
+            recorder_close(gfx->recorder);
+            gfx->recorder = NULL;
+        }
+
+        scaler_destroy(&gfx->scaler);
+
+        // Stops the presenter thread before its frames go away.
         window_destroy(&gfx->window);
 
+        if (gfx->frames != NULL) {
+            tb_destroy(gfx->frames);
+            gfx->frames = NULL;
+        }
+
         if (gfx->background != NULL) {
             SDL_FreeSurface(gfx->background);
             gfx->background = NULL;
@@ -98,24 +214,131 @@ void graphics_destroy(gfx_t *gfx)
             gfx->sprites_fg = NULL;
         }
 
-        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        if (!gfx->headless) {
+            SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        }
     }
 }
 
 bool graphics_lock(context_t *ctx)
 {
-    if (SDL_LockSurface(ctx->gfx.window.surface) < 0)
-    {
-        log_dbg(ctx, "Can not lock surface: %s", SDL_GetError());
-        return false;
+    for (size_t i = 0; i < NUM(ctx->gfx.layers); i++) {
+        if (SDL_LockSurface(ctx->gfx.layers[i]) < 0)
+        {
+            log_dbg(ctx, "Can not lock surface: %s", SDL_GetError());
+
+            while (i-- > 0) {
+                SDL_UnlockSurface(ctx->gfx.layers[i]);
+            }
+            return false;
+        }
     }
-    
+
     return true;
 }
 
 void graphics_unlock(context_t *ctx)
 {
-    SDL_UnlockSurface(ctx->gfx.window.surface);
+    for (size_t i = 0; i < NUM(ctx->gfx.layers); i++) {
+        SDL_UnlockSurface(ctx->gfx.layers[i]);
+    }
+}
+
+/*
+ * Makes all layers transparent again.
+ */
+static void
+clear_layers(gfx_t *gfx)
+{
+    for (size_t i = 0; i < NUM(gfx->layers); i++) {
+        SDL_FillRect(gfx->layers[i], NULL, 0x00);
+    }
+}
+
+/*
+ * Combines line <y> of the layers into <dst>.
+ */
+static void
+compose_line(context_t *ctx, size_t y, uint8_t *dst)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    // Highest priority first, gfx->layers[i] is drawn as layer i + 1.
+    const SDL_Surface* layers[] = {
+        gfx->layers[2], gfx->layers[0], gfx->layers[1]
+    };
+    const uint8_t offsets[] = {
+        graphics_get_debug(ctx, 3) ? 4 * 3 : 0,
+        graphics_get_debug(ctx, 1) ? 4 * 1 : 0,
+        graphics_get_debug(ctx, 2) ? 4 * 2 : 0,
+    };
+
+    for (size_t x = 0; x < SCREEN_WIDTH; x++) {
+        uint8_t color = 0;
+
+        for (size_t i = 0; i < NUM(layers); i++) {
+            const uint8_t* row = (const uint8_t*)layers[i]->pixels +
+                y * layers[i]->pitch;
+
+            if (row[x] != 0) {
+                color = row[x] + offsets[i];
+                break;
+            }
+        }
+
+        dst[x] = color;
+    }
+}
+
+/*
+ * Combines the layers into a frame and hands it to the window. Never
+ * waits for the window, if it is still busy with an older frame, that
+ * one is dropped instead.
+ */
+void graphics_present(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+    frame_t *frame = (frame_t*)tb_back(gfx->frames);
+
+    for (size_t y = 0; y < SCREEN_HEIGHT; y++) {
+        compose_line(ctx, y, frame->pixels[y]);
+        frame_hash_line(frame, y);
+        observer_line(&gfx->observer, frame->pixels[y], y);
+    }
+
+    frame_hash(frame);
+    frame->timestamp = SDL_GetPerformanceCounter();
+
+    if (gfx->recorder != NULL) {
+        recorder_push(gfx->recorder, frame);
+    }
+
+    if (gfx->headless) {
+        tb_publish(gfx->frames);
+    } else {
+        if (tb_publish(gfx->frames)) {
+            gfx->frames_dropped++;
+        }
+
+        window_present(&gfx->window, gfx->frames);
+    }
+
+    clear_layers(gfx);
+}
+
+/*
+ * Keeps a skipped frame that was drawn anyway for max pooling, see
+ * observer_init. Nothing is presented.
+ */
+void graphics_pool(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    for (size_t y = 0; y < SCREEN_HEIGHT; y++) {
+        compose_line(ctx, y, gfx->observer.previous[y]);
+    }
+
+    clear_layers(gfx);
 }
 
 void hblank(context_t*);
@@ -127,9 +350,35 @@ void vblank_wait(context_t*);
 void oam_wait(context_t*);
 
 /*
- * Updates the screen.
+ * Updates the screen, see gfx_backend_t.
  */
 void graphics_update(context_t *ctx, int cycles)
+{
+    ctx->gfx.backend->update(ctx, cycles);
+}
+
+/*
+ * Selects the PPU implementation. Fast is the default, accurate is for
+ * games that depend on the length of mode 3 or change registers in the
+ * middle of a line. The current frame starts over at its first line.
+ */
+void graphics_set_backend(context_t *ctx, ppu_backend_t backend)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    gfx->backend = backend == PPU_ACCURATE ?
+        &gfx_fifo_backend : &gfx_fast_backend;
+
+    clear_layers(gfx);
+    gfx->window_y = 0;
+    ctx->mem.io.LY = 0;
+
+    graphics_frame_start(ctx);
+    gfx->backend->reset(ctx);
+}
+
+static void
+fast_update(context_t *ctx, int cycles)
 {
     // context->state starts in OAM. As soon as a certain
     // amount of cycles is reached, state transitions
@@ -142,6 +391,10 @@ void graphics_update(context_t *ctx, int cycles)
         ctx->gfx.state = VBLANK_WAIT;
         ctx->gfx.cycles = 0;
 
+        // Nothing is displayed, so there is nothing left to draw.
+        ctx->gfx.next_line = SCREEN_HEIGHT;
+        ctx->gfx.writes_len = ctx->gfx.writes_read = 0;
+
         return;
     }
 
@@ -162,8 +415,18 @@ void graphics_update(context_t *ctx, int cycles)
     }
 }
 
-static palette_t
-palette_decode(uint8_t raw_palette)
+static void
+fast_reset(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    gfx->cycles = 0;
+    gfx->writes_len = gfx->writes_read = 0;
+    graphics_set_mode(ctx, OAM);
+}
+
+palette_t
+graphics_palette_decode(uint8_t raw_palette)
 {
     /* Palettes are packed into an uint8_t and map color indexes to actual
      * colors. This is the layout:
@@ -182,39 +445,240 @@ palette_decode(uint8_t raw_palette)
     return palette;
 }
 
+void
+graphics_sprite_decode(sprite_t *sprite, const memory_oam_t* oam)
+{
+    /* OAM entries are 4 bytes: y + 16, x + 8, tile and flags. */
+    sprite->y       = oam->data[0] - SPRITE_HEIGHT;
+    sprite->x       = oam->data[1] - SPRITE_WIDTH;
+    sprite->tile_id = oam->data[2];
+
+    sprite->in_background = BIT_ISSET(oam->data[3], 7);
+    sprite->flip_y        = BIT_ISSET(oam->data[3], 6);
+    sprite->flip_x        = BIT_ISSET(oam->data[3], 5);
+    sprite->high_palette  = BIT_ISSET(oam->data[3], 4);
+}
+
+/*
+ * The tile of <sprite> that is displayed on screen line <line>, and the
+ * line within it. 8x16 sprites ignore the lowest bit of their tile.
+ */
+const memory_tile_t*
+graphics_sprite_tile(const memory_t *mem, const sprite_t *sprite, int line,
+    size_t *tile_y)
+{
+    const size_t height = lcdc_sprite_height(mem);
+    size_t row = line - sprite->y;
+    uint8_t tile_id = sprite->tile_id;
+
+    if (sprite->flip_y) {
+        row = height - 1 - row;
+    }
+
+    if (height > TILE_HEIGHT) {
+        tile_id = (tile_id & 0xFE) + row / TILE_HEIGHT;
+    }
+
+    *tile_y = row % TILE_HEIGHT;
+    return &mem->gfx.tiles.data[tile_id];
+}
+
+static bool
+is_logged_register(uint16_t addr)
+{
+    switch (addr) {
+        case offsetof(memory_io_t, LCDC):
+        case offsetof(memory_io_t, SCY):
+        case offsetof(memory_io_t, SCX):
+        case offsetof(memory_io_t, BGP):
+        case offsetof(memory_io_t, SPP_LOW):
+        case offsetof(memory_io_t, SPP_HIGH):
+        case offsetof(memory_io_t, WY):
+        case offsetof(memory_io_t, WX):
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Bumps the versions that invalidate cached planes.
+ */
+void
+graphics_track_vram(gfx_t *gfx, uint16_t addr)
+{
+    switch (addr) {
+        case range_of(memory_gfx_t, tiles):
+            gfx->tile_versions[(addr - offsetof(memory_gfx_t, tiles)) /
+                sizeof(memory_tile_t)]++;
+            // fallthrough
+        case range_of(memory_gfx_t, tile_maps):
+            if (++gfx->vram_version == 0) {
+                gfx->vram_version = 1;
+            }
+            break;
+    }
+}
+
 static void
-sprite_decode(sprite_t *sprite, const memory_oam_t* oam)
+regs_save(gfx_regs_t *regs, const memory_t *mem)
 {
-    sprite->y      = MAX(0, oam->data[0]  - SPRITE_HEIGHT);
-    sprite->x      = MAX(0, oam->data[1]  - SPRITE_WIDTH);
-    sprite->tile_y = MAX(0, SPRITE_HEIGHT - oam->data[0]);
-    sprite->tile_x = MAX(0, SPRITE_WIDTH  - oam->data[1]);
+    regs->LCDC     = mem->io.LCDC;
+    regs->SCY      = mem->io.SCY;
+    regs->SCX      = mem->io.SCX;
+    regs->BGP      = mem->io.BGP;
+    regs->SPP_LOW  = mem->io.SPP_LOW;
+    regs->SPP_HIGH = mem->io.SPP_HIGH;
+    regs->WY       = mem->io.WY;
+    regs->WX       = mem->io.WX;
+}
 
-    if (sprite->tile_y < TILE_HEIGHT) {
-        sprite->tile_id = oam->data[2] & 0xFE;
-    } else {
-        sprite->tile_id = oam->data[2] | 0x01;
+static void
+regs_restore(memory_t *mem, const gfx_regs_t *regs)
+{
+    mem->io.LCDC     = regs->LCDC;
+    mem->io.SCY      = regs->SCY;
+    mem->io.SCX      = regs->SCX;
+    mem->io.BGP      = regs->BGP;
+    mem->io.SPP_LOW  = regs->SPP_LOW;
+    mem->io.SPP_HIGH = regs->SPP_HIGH;
+    mem->io.WY       = regs->WY;
+    mem->io.WX       = regs->WX;
+}
+
+/*
+ * Called by the memory subsystem before a write to VRAM, OAM or a PPU
+ * register.
+ */
+void graphics_write(context_t *ctx, uint16_t addr, uint8_t value)
+{
+    // DMA is never stored, and copies to OAM whatever it was set to.
+    if (addr == offsetof(memory_io_t, DMA) || ctx->mem.map[addr] != value) {
+        ctx->gfx.backend->write(ctx, addr, value);
+    }
+}
+
+/*
+ * The fast backend does not draw lines while they are displayed but in
+ * one go on VBLANK, so anything that changes how a line looks needs to
+ * be accounted for:
+ *
+ * - Register writes are logged with their LY, and replayed line by line
+ *   when the frame is drawn. Most frames don't have any.
+ * - VRAM and OAM are too big to log, so all lines that have already been
+ *   displayed are drawn before the write goes through.
+ */
+static void
+fast_write(context_t *ctx, uint16_t addr, uint8_t value)
+{
+    gfx_t *gfx = &ctx->gfx;
+    const uint8_t ly = ctx->mem.io.LY;
+
+    if (!lcdc_display_enabled(&ctx->mem) ||
+        gfx->next_line >= SCREEN_HEIGHT)
+    {
+        // Nothing left to draw in this frame.
+        graphics_track_vram(gfx, addr);
+        return;
+    }
+
+    if (!is_logged_register(addr) || ly >= SCREEN_HEIGHT) {
+        graphics_catch_up(ctx, MIN(ly, SCREEN_HEIGHT));
+        graphics_track_vram(gfx, addr);
+        return;
+    }
+
+    // A line sees all writes up to its LY, so only the last write to a
+    // register during a line matters.
+    for (size_t i = gfx->writes_len; i > gfx->writes_read; i--) {
+        gfx_write_t *write = &gfx->writes[i - 1];
+
+        if (write->ly != ly) {
+            break;
+        }
+
+        if (write->addr == addr) {
+            write->value = value;
+            return;
+        }
+    }
+
+    if (gfx->writes_len == NUM(gfx->writes)) {
+        // The log spans the whole frame, raster effects on every line
+        // fill it up. Drawing the lines before this one frees everything
+        // but this line's writes, which are at most one per register.
+        graphics_catch_up(ctx, ly);
+
+        gfx->writes_len -= gfx->writes_read;
+        memmove(gfx->writes, &gfx->writes[gfx->writes_read],
+            gfx->writes_len * sizeof gfx->writes[0]);
+        gfx->writes_read = 0;
+    }
+
+    if (gfx->writes_len == 0) {
+        regs_save(&gfx->regs, &ctx->mem);
+    }
+
+    gfx->writes[gfx->writes_len++] = (gfx_write_t){
+        .ly = ly,
+        .addr = addr,
+        .value = value,
+    };
+}
+
+/*
+ * Draws all lines up to (but excluding) <line> that have not been
+ * drawn yet.
+ */
+void graphics_catch_up(context_t *ctx, int line)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    if (gfx->next_line >= line) {
+        return;
     }
 
-    sprite->visible = false;
-    if (sprite->tile_x < SPRITE_WIDTH && sprite->tile_y < SPRITE_HEIGHT) {
-        sprite->visible = true;
+    if (gfx->writes_len == 0) {
+        // Registers did not change since next_line was displayed.
+        for (; gfx->next_line < line; gfx->next_line++) {
+            draw_line(ctx, gfx->next_line);
+        }
+
+        return;
     }
 
-    sprite->tile_y %= TILE_HEIGHT;
+    // Swap in the registers as they were when next_line was displayed
+    // and replay the logged writes. A line sees all writes up to and
+    // including its own LY, since LY is incremented right after a line
+    // has been transferred to the LCD.
+    gfx_regs_t current;
+    regs_save(&current, &ctx->mem);
+    regs_restore(&ctx->mem, &gfx->regs);
+
+    for (; gfx->next_line < line; gfx->next_line++) {
+        while (gfx->writes_read < gfx->writes_len &&
+            gfx->writes[gfx->writes_read].ly <= gfx->next_line)
+        {
+            const gfx_write_t *write = &gfx->writes[gfx->writes_read++];
+            ctx->mem.map[write->addr] = write->value;
+        }
 
-    sprite->in_background = BIT_ISSET(oam->data[2], 7);
-    sprite->flip_y        = BIT_ISSET(oam->data[2], 6);
-    sprite->flip_x        = BIT_ISSET(oam->data[2], 5);
-    sprite->high_palette  = BIT_ISSET(oam->data[2], 4);
+        draw_line(ctx, gfx->next_line);
+    }
+
+    regs_save(&gfx->regs, &ctx->mem);
+    regs_restore(&ctx->mem, &current);
+
+    if (gfx->writes_read == gfx->writes_len) {
+        gfx->writes_len = gfx->writes_read = 0;
+    }
 }
 
 void
-draw_line(context_t *ctx) {
+draw_line(context_t *ctx, uint8_t screen_y) {
     gfx_t* gfx = &ctx->gfx;
-    uint8_t screen_y = ctx->mem.io.LY;
 
-    map_t src;
+    const plane_t* plane;
     dest_t dest;
     palette_t palette;
 
@@ -226,13 +690,10 @@ draw_line(context_t *ctx) {
     // Background
     if (lcdc_background_enabled(&ctx->mem))
     {
-        palette = palette_decode(ctx->mem.io.BGP);
+        palette = graphics_palette_decode(ctx->mem.io.BGP);
 
-        map_init(
-            &src, &ctx->mem,
-            lcdc_background_tile_map(&ctx->mem),
-            ctx->mem.io.SCX, screen_y + ctx->mem.io.SCY
-        );
+        plane = plane_get(gfx, &ctx->mem,
+            lcdc_background_tile_map(&ctx->mem));
 
         dest_init(
             &dest,
@@ -240,32 +701,33 @@ draw_line(context_t *ctx) {
             0, screen_y, SCREEN_WIDTH
         );
         
-        draw_tiles(&dest, &src, palette);
+        plane_draw_line(&dest, plane,
+            ctx->mem.io.SCX, screen_y + ctx->mem.io.SCY, palette);
     }
 
-    // Window
-    uint8_t window_y = ctx->mem.io.WY;
-    // TODO: What happens on underflow?
-    uint8_t window_x = ctx->mem.io.WX - 7;
-    
-    if (lcdc_window_enabled(&ctx->mem) && screen_y >= window_y &&
+    // Window, which starts at its own first line and column. It is
+    // turned off together with the background.
+    const int window_x = ctx->mem.io.WX - 7;
+
+    if (lcdc_window_enabled(&ctx->mem) && screen_y >= ctx->mem.io.WY &&
         window_x < SCREEN_WIDTH)
     {
-        palette = palette_decode(ctx->mem.io.BGP);
+        if (lcdc_background_enabled(&ctx->mem)) {
+            palette = graphics_palette_decode(ctx->mem.io.BGP);
 
-        map_init(
-            &src, &ctx->mem,
-            lcdc_window_tile_map(&ctx->mem),
-            window_x, screen_y + gfx->window_y
-        );
+            plane = plane_get(gfx, &ctx->mem,
+                lcdc_window_tile_map(&ctx->mem));
 
-        dest_init(
-            &dest,
-            gfx->background,
-            window_x, screen_y, SCREEN_WIDTH - window_x
-        );
+            dest_init(
+                &dest,
+                gfx->background,
+                MAX(0, window_x), screen_y, SCREEN_WIDTH
+            );
+
+            plane_draw_line(&dest, plane,
+                MAX(0, -window_x), gfx->window_y, palette);
+        }
 
-        draw_tiles(&dest, &src, palette);
         gfx->window_y += 1;
     }
     
@@ -276,62 +738,71 @@ draw_line(context_t *ctx) {
 
         sprite_table_t sprites = { .length = 0 };
         
-        for (size_t i = 0; i < MAX_SPRITES; i++)
+        // Only the first SPRITES_PER_LINE sprites in OAM are displayed,
+        // even if some of them are off screen.
+        for (size_t i = 0; i < MAX_SPRITES &&
+            sprites.length < SPRITES_PER_LINE; i++)
         {
             sprite_t sprite;
-            sprite_decode(&sprite, &ctx->mem.gfx.oam[i]);
+            graphics_sprite_decode(&sprite, &ctx->mem.gfx.oam[i]);
 
-            if (!sprite.visible) {
-                continue;
-            }
-            
-            if (screen_y >= sprite.y && screen_y < sprite.y + sprite_height)
+            if (screen_y >= sprite.y &&
+                screen_y < sprite.y + (int)sprite_height)
             {
                 graphics_sprite_table_add(&sprites, &sprite);
             }
         }
 
         palette_t spp_high, spp_low;
-        spp_high = palette_decode(ctx->mem.io.SPP_HIGH);
-        spp_low  = palette_decode(ctx->mem.io.SPP_LOW);
+        spp_high = graphics_palette_decode(ctx->mem.io.SPP_HIGH);
+        spp_low  = graphics_palette_decode(ctx->mem.io.SPP_LOW);
+
+        uint8_t* fg = (uint8_t*)gfx->sprites_fg->pixels +
+            screen_y * gfx->sprites_fg->pitch;
+        uint8_t* bg = (uint8_t*)gfx->sprites_bg->pixels +
+            screen_y * gfx->sprites_bg->pitch;
 
-        // <sprites> holds the 10 sprites with highest priority,
-        // sorted by ascending x coordinate. Since sprites
+        // <sprites> is sorted by ascending x coordinate. Since sprites
         // with lower x coords write over tiles with higher x coords
         // we draw in reverse order.
         for (int i = sprites.length - 1; i >= 0; i--)
         {
             const sprite_t* sprite = &sprites.data[i];
-            source_t src;
-            dest_t dst;
-
-            if (sprite->x >= SCREEN_WIDTH) {
-                continue;
+            const palette_t palette = sprite->high_palette ?
+                spp_high : spp_low;
+            size_t tile_y;
+
+            const memory_tile_t* tile = graphics_sprite_tile(&ctx->mem,
+                sprite, screen_y, &tile_y);
+
+            for (int tile_x = 0; tile_x < TILE_WIDTH; tile_x++) {
+                const int x = sprite->x + tile_x;
+                const uint8_t color = tile_pixel(tile,
+                    sprite->flip_x ? TILE_WIDTH - 1 - tile_x : tile_x,
+                    tile_y);
+
+                // Color 0 is transparent.
+                if (x < 0 || x >= SCREEN_WIDTH || color == 0) {
+                    continue;
+                }
+
+                // A sprite also covers lower priority sprites on the
+                // other layer.
+                fg[x] = sprite->in_background ? 0 : palette.colors[color];
+                bg[x] = sprite->in_background ? palette.colors[color] : 0;
             }
-
-            source_init(
-                &src,
-                &ctx->mem.gfx.tiles.data[sprite->tile_id],
-                sprite->tile_x, sprite->tile_y + (screen_y - sprite->y)
-            );
-
-            dest_init(
-                &dst,
-                sprite->in_background ? gfx->sprites_bg : gfx->sprites_fg,
-                sprite->x, screen_y, TILE_WIDTH
-            );
-
-            draw_tile(
-                &dst,
-                &src,
-                sprite->high_palette ? spp_high : spp_low
-            );
         }
     }
 
     graphics_unlock(ctx);
 }
 
+const gfx_backend_t gfx_fast_backend = {
+    .update = fast_update,
+    .write = fast_write,
+    .reset = fast_reset,
+};
+
 void graphics_sprite_table_add(sprite_table_t *table, const sprite_t* sprite)
 {
     size_t i;
@@ -357,61 +828,170 @@ void graphics_sprite_table_add(sprite_table_t *table, const sprite_t* sprite)
     }
 }
 
+/*
+ * Draws a tile in shades of grey at x/y of the window's surface, which
+ * has to be big enough.
+ */
 void graphics_draw_tile(const context_t* ctx, window_t* window,
     uint16_t tile_id, size_t x, size_t y)
 {
-    palette_t palette = {
-        {0, 1, 2, 3}
-    };
+    const memory_tile_t* tile = &ctx->mem.gfx.tiles.data[tile_id];
+    SDL_Surface* surface = window->surface;
+
+    assert(x + TILE_WIDTH <= (size_t)surface->w);
+    assert(y + TILE_HEIGHT <= (size_t)surface->h);
 
     for (size_t tile_y = 0; tile_y < TILE_HEIGHT; tile_y++) {
-        source_t src;
-        dest_t dst;
+        uint32_t* row = (uint32_t*)((uint8_t*)surface->pixels +
+            (y + tile_y) * surface->pitch) + x;
 
-        dest_init(&dst, window->surface, x, y + tile_y, window->surface->w - x);
-        source_init(&src, &ctx->mem.gfx.tiles.data[tile_id], 0, tile_y);
-        draw_tile(&dst, &src, palette);
+        for (size_t tile_x = 0; tile_x < TILE_WIDTH; tile_x++) {
+            row[tile_x] = window->colors[tile_pixel(tile, tile_x, tile_y)];
+        }
     }
 }
 
-void graphics_toggle_debug(context_t* ctx, graphics_layer_t layer)
+/*
+ * Only draw and present every <frames>th frame, 0 or 1 draw all of them.
+ * Timing, interrupts and LY are not affected. With max pooled
+ * observations, the frame before each drawn one is drawn as well.
+ *
+ * The accurate backend still steps through skipped frames dot by dot,
+ * since the length of mode 3 depends on them. It only saves the VRAM
+ * reads and the pixel mixing.
+ */
+void graphics_set_frame_skip(context_t* ctx, unsigned int frames)
 {
-    static const SDL_Color debug[3][4] = {
-        {
-            {0xFF, 0x00, 0x00, 0x00}, // Transparent
-            {0xD8, 0x8A, 0xDC, 0xFF}, // Light grey
-            {0x9E, 0x51, 0xA3, 0xFF}, // Dark grey
-            {0x4D, 0x00, 0x52, 0xFF}, // Black
-        },
-        {
-            {0xFF, 0x00, 0x00, 0x00}, // Transparent
-            {0x8A, 0xDC, 0x90, 0xFF}, // Light grey
-            {0x51, 0xA3, 0x57, 0xFF}, // Dark grey
-            {0x00, 0x52, 0x06, 0xFF}, // Black
-        },
-        {
-            {0xFF, 0x00, 0x00, 0x00}, // Transparent
-            {0x8A, 0xDC, 0xD8, 0xFF}, // Light grey
-            {0x51, 0xA3, 0x9E, 0xFF}, // Dark grey
-            {0x00, 0x52, 0x4D, 0xFF}, // Black
-        }
-    };
+    ctx->gfx.frame_skip = frames;
+    ctx->gfx.frames_until_drawn = 0;
+}
 
-    const SDL_Color *palette;
+void graphics_get_frame_stats(const context_t* ctx, uint64_t* drawn,
+    uint64_t* skipped)
+{
+    *drawn = ctx->gfx.frames_drawn;
+    *skipped = ctx->gfx.frames_skipped;
+}
 
-    if (ctx->gfx.debug_flags & layer) {
-        ctx->gfx.debug_flags &= ~layer;
-        palette = sdl_palette;
-    } else {
-        ctx->gfx.debug_flags |= layer;
-        palette = debug[layer - 1];
+void graphics_get_present_stats(const context_t* ctx, present_stats_t* stats)
+{
+    const window_t* window = &ctx->gfx.window;
+
+    stats->presented = atomic_load(&window->presented);
+    stats->dropped = ctx->gfx.frames_dropped;
+    stats->unchanged = atomic_load(&window->unchanged);
+    stats->latency_us = atomic_load(&window->latency_us);
+    stats->max_latency_us = atomic_load(&window->max_latency_us);
+}
+
+void graphics_set_vsync(context_t* ctx, bool enabled)
+{
+    window_set_vsync(&ctx->gfx.window, enabled);
+}
+
+bool graphics_get_vsync(const context_t* ctx)
+{
+    return atomic_load(&ctx->gfx.window.vsync);
+}
+
+/*
+ * Records every <every>th drawn frame to <filename>, see recorder_open.
+ * Frames are scaled like graphics_get_scaled_frame, but on the writer
+ * thread. They are written on a separate thread and dropped if it can't
+ * keep up.
+ */
+bool graphics_start_recording(context_t* ctx, const char* filename,
+    record_format_t format, unsigned int every)
+{
+    const scaler_t* scaler = &ctx->gfx.scaler;
+
+    graphics_stop_recording(ctx);
+
+    ctx->gfx.recorder = recorder_open(filename, format, every,
+        scaler->filter, scaler->factor);
+
+    return ctx->gfx.recorder != NULL;
+}
+
+/*
+ * Returns false if any recorded frame was lost.
+ */
+bool graphics_stop_recording(context_t* ctx)
+{
+    bool ok = true;
+
+    if (ctx->gfx.recorder != NULL) {
+        ok = recorder_close(ctx->gfx.recorder);
+        ctx->gfx.recorder = NULL;
+    }
+
+    return ok;
+}
+
+/*
+ * Scales frames by <factor> with <filter>, see scaler_init. Applies to
+ * graphics_get_scaled_frame and to recordings started afterwards.
+ */
+bool graphics_set_scale(context_t* ctx, scale_filter_t filter,
+    unsigned int factor)
+{
+    scaler_t scaler;
+
+    if (!scaler_init(&scaler, filter, factor)) {
+        return false;
     }
 
-    assert(SDL_SetPaletteColors(ctx->gfx.layers[layer - 1]->format->palette,
-        palette, 0, 4) == 0);
+    scaler_destroy(&ctx->gfx.scaler);
+    ctx->gfx.scaler = scaler;
+
+    return true;
+}
+
+/*
+ * The last drawn frame, scaled to <width> x <height> color indexes. The
+ * frame is only scaled once, no matter how often it is asked for. Stays
+ * valid until the next frame is drawn.
+ */
+const uint8_t* graphics_get_scaled_frame(context_t* ctx, size_t* width,
+    size_t* height)
+{
+    *width = ctx->gfx.scaler.width;
+    *height = ctx->gfx.scaler.height;
+
+    return scaler_apply(&ctx->gfx.scaler, context_get_framebuffer(ctx),
+        context_get_frame_hash(ctx));
+}
+
+/*
+ * Also stores drawn frames as <width> x <height> observations, see
+ * observer_init. OBSERVE_NONE turns this off again.
+ */
+bool graphics_set_observation(context_t* ctx, observation_format_t format,
+    size_t width, size_t height, bool max_pool)
+{
+    return observer_init(&ctx->gfx.observer, format, width, height,
+        max_pool);
+}
+
+/*
+ * The observation of the last drawn frame, <len> bytes long. Stays valid
+ * until the next frame is drawn.
+ */
+const uint8_t* graphics_get_observation(const context_t* ctx, size_t* len)
+{
+    *len = observer_size(&ctx->gfx.observer);
+    return ctx->gfx.observer.pixels;
+}
+
+/*
+ * Draws <layer> in distinct colors, see frame_colors.
+ */
+void graphics_toggle_debug(context_t* ctx, graphics_layer_t layer)
+{
+    ctx->gfx.debug_flags ^= 1 << layer;
 }
 
 bool graphics_get_debug(const context_t* ctx, graphics_layer_t layer)
 {
-    return ctx->gfx.debug_flags & layer;
+    return ctx->gfx.debug_flags & (1 << layer);
 }
@@ -0,0 +1,461 @@
+#include <string.h>
+
+#include "context.h"
+#include "cpu.h"
+#include "ioregs.h"
+#include "graphics/tiles.h"
+
+#define NUM(x) (sizeof x / sizeof x[0])
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define DOTS_PER_LINE (456)
+#define LINES_PER_FRAME (154)
+#define OAM_DOTS (80)
+
+// Fetching a tile takes 2 dots each for its id and both bit planes.
+#define FETCH_DOTS (6)
+
+/*
+ * The accurate PPU, advanced one dot at a time:
+ *
+ * - Mode 2 lasts 80 dots, at its end the sprites on the line are picked.
+ * - Mode 3 shifts out one pixel per dot. It starts with a tile fetch that
+ *   is thrown away, discards SCX % 8 pixels, restarts the fetcher when
+ *   the window begins and stalls while sprites are fetched. It lasts 172
+ *   dots at least.
+ * - Mode 0 pads the line to 456 dots.
+ *
+ * Finished lines are copied to the layers, so frames are composed and
+ * presented like with the fast backend. Skipped frames still go through
+ * every dot to keep the timing, but nothing is read from VRAM and no
+ * pixels are mixed.
+ */
+
+static void
+fifo_reset(context_t *ctx)
+{
+    memset(&ctx->gfx.fifo, 0, sizeof ctx->gfx.fifo);
+    ctx->gfx.window_y = 0;
+    ctx->mem.io.LY = 0;
+}
+
+static void
+line_start(context_t *ctx)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+    const uint8_t ly = ctx->mem.io.LY;
+
+    if (ly == ctx->mem.io.LYC) {
+        stat_lyc_set(&ctx->mem);
+        if (stat_lyc_irq_enabled(&ctx->mem)) {
+            cpu_irq(ctx, I_LCDC);
+        }
+    } else {
+        stat_lyc_clear(&ctx->mem);
+    }
+
+    if (ly == SCREEN_HEIGHT) {
+        graphics_set_mode(ctx, VBLANK);
+        graphics_frame_end(ctx);
+    } else if (ly < SCREEN_HEIGHT) {
+        if (ly == ctx->mem.io.WY) {
+            fifo->window_triggered = true;
+        }
+
+        graphics_set_mode(ctx, OAM);
+    }
+}
+
+/*
+ * Picks the sprites on the current line and enters mode 3.
+ */
+static void
+transfer_start(context_t *ctx)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+    const int ly = ctx->mem.io.LY;
+    const int height = lcdc_sprite_height(&ctx->mem);
+
+    fifo->sprites_len = 0;
+
+    for (size_t i = 0; i < MAX_SPRITES &&
+        fifo->sprites_len < NUM(fifo->sprites); i++)
+    {
+        sprite_t *sprite = &fifo->sprites[fifo->sprites_len];
+        graphics_sprite_decode(sprite, &ctx->mem.gfx.oam[i]);
+
+        if (ly >= sprite->y && ly < sprite->y + height) {
+            fifo->fetched[fifo->sprites_len++] = false;
+        }
+    }
+
+    fifo->lx = 0;
+    fifo->discard = ctx->mem.io.SCX % TILE_WIDTH;
+    fifo->bg_len = fifo->obj_len = 0;
+    fifo->obj_fetch = 0;
+    fifo->fetch_x = 0;
+    fifo->in_window = false;
+
+    // The first fetch of a line is thrown away.
+    fifo->step = -FETCH_DOTS;
+
+    graphics_set_mode(ctx, TRANSF);
+}
+
+/*
+ * Copies the finished line to the layers and enters mode 0.
+ */
+static void
+transfer_end(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+    fifo_t *fifo = &gfx->fifo;
+    const uint8_t ly = ctx->mem.io.LY;
+
+    if (fifo->in_window) {
+        gfx->window_y++;
+    }
+
+    if (!gfx->skip_frame && graphics_lock(ctx)) {
+        for (size_t i = 0; i < NUM(gfx->layers); i++) {
+            uint8_t *row = (uint8_t*)gfx->layers[i]->pixels +
+                ly * gfx->layers[i]->pitch;
+
+            memcpy(row, fifo->line[i], SCREEN_WIDTH);
+        }
+
+        graphics_unlock(ctx);
+    }
+
+    graphics_set_mode(ctx, HBLANK);
+}
+
+static bool
+window_due(const context_t *ctx)
+{
+    const fifo_t *fifo = &ctx->gfx.fifo;
+    const int wx = ctx->mem.io.WX;
+
+    return !fifo->in_window && fifo->window_triggered &&
+        lcdc_window_enabled(&ctx->mem) && wx - 7 < SCREEN_WIDTH &&
+        fifo->lx == MAX(0, wx - 7);
+}
+
+/*
+ * Switches the fetcher to the window, throwing away the background
+ * pixels that are left.
+ */
+static void
+window_start(context_t *ctx)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+
+    fifo->in_window = true;
+    fifo->bg_len = 0;
+    fifo->fetch_x = 0;
+
+    // Replaces the SCX discard, the window does not scroll.
+    fifo->discard = MAX(0, 7 - ctx->mem.io.WX);
+
+    if (fifo->step > 0) {
+        fifo->step = 0;
+    }
+}
+
+static void
+fetcher_tick(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+    fifo_t *fifo = &gfx->fifo;
+    const memory_t *mem = &ctx->mem;
+
+    fifo->step++;
+
+    // Skipped frames only need the timing of the fetcher, no step
+    // fetches anything for them.
+    switch (gfx->skip_frame ? 0 : fifo->step) {
+        case 1: {
+            tile_map_t map;
+            uint8_t column, y;
+
+            if (fifo->in_window) {
+                map = lcdc_window_tile_map(mem);
+                column = fifo->fetch_x;
+                y = gfx->window_y;
+            } else {
+                map = lcdc_background_tile_map(mem);
+                column = mem->io.SCX / TILE_WIDTH + fifo->fetch_x;
+                y = mem->io.LY + mem->io.SCY;
+            }
+
+            fifo->tile_id = mem->gfx.tile_maps[map].data
+                [(y / TILE_HEIGHT) % MAP_ROWS][column % MAP_COLUMNS];
+            fifo->tile_y = y % TILE_HEIGHT;
+            break;
+        }
+
+        case 3:
+        case 5: {
+            const uint16_t index = lcdc_unsigned_tile_ids(mem) ?
+                fifo->tile_id : 256 + (int8_t)fifo->tile_id;
+            const uint8_t* line = mem->gfx.tiles.data[index].lines[fifo->tile_y];
+
+            if (fifo->step == 3) {
+                fifo->tile_low = line[0];
+            } else {
+                fifo->tile_high = line[1];
+            }
+            break;
+        }
+    }
+
+    // The tile is pushed as soon as the FIFO is empty.
+    if (fifo->step >= FETCH_DOTS && fifo->bg_len == 0) {
+        fifo->bg_low = fifo->tile_low;
+        fifo->bg_high = fifo->tile_high;
+        fifo->bg_len = TILE_WIDTH;
+        fifo->fetch_x++;
+        fifo->step = 0;
+    }
+}
+
+/*
+ * Starts fetching the next sprite at the current pixel, if any. Lower
+ * x coordinates are fetched first and win over later sprites.
+ */
+static bool
+sprite_due(context_t *ctx)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+    bool due = false;
+
+    if (!lcdc_sprites_enabled(&ctx->mem)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < fifo->sprites_len; i++) {
+        if (fifo->fetched[i] || fifo->sprites[i].x > fifo->lx) {
+            continue;
+        }
+
+        if (!due || fifo->sprites[i].x < fifo->sprites[fifo->obj_index].x) {
+            fifo->obj_index = i;
+            due = true;
+        }
+    }
+
+    if (due) {
+        fifo->fetched[fifo->obj_index] = true;
+    }
+
+    return due;
+}
+
+/*
+ * Mixes the sprite into the sprite FIFO. Pixels already in there are
+ * only replaced if they are transparent.
+ */
+static void
+sprite_fetch(context_t *ctx, const sprite_t *sprite)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+    size_t tile_y;
+
+    const memory_tile_t* tile = graphics_sprite_tile(&ctx->mem, sprite,
+        ctx->mem.io.LY, &tile_y);
+
+    for (int tile_x = 0; tile_x < TILE_WIDTH; tile_x++) {
+        const int slot = sprite->x + tile_x - fifo->lx;
+
+        if (slot < 0) {
+            // Left of the screen.
+            continue;
+        }
+
+        const fifo_pixel_t pixel = {
+            .color = tile_pixel(tile,
+                sprite->flip_x ? TILE_WIDTH - 1 - tile_x : tile_x, tile_y),
+            .in_background = sprite->in_background,
+            .high_palette = sprite->high_palette,
+        };
+
+        if (slot >= fifo->obj_len) {
+            fifo->obj[slot] = pixel;
+            fifo->obj_len = slot + 1;
+        } else if (fifo->obj[slot].color == 0) {
+            fifo->obj[slot] = pixel;
+        }
+    }
+}
+
+static void
+pixel_output(context_t *ctx)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+    const memory_t *mem = &ctx->mem;
+    fifo_pixel_t obj = { .color = 0 };
+
+    const uint8_t color = ((fifo->bg_high >> 7) << 1) | (fifo->bg_low >> 7);
+
+    fifo->bg_low <<= 1;
+    fifo->bg_high <<= 1;
+    fifo->bg_len--;
+
+    if (fifo->discard > 0) {
+        fifo->discard--;
+        return;
+    }
+
+    if (ctx->gfx.skip_frame) {
+        if (++fifo->lx == SCREEN_WIDTH) {
+            transfer_end(ctx);
+        }
+        return;
+    }
+
+    if (fifo->obj_len > 0) {
+        obj = fifo->obj[0];
+        fifo->obj_len--;
+        memmove(&fifo->obj[0], &fifo->obj[1],
+            fifo->obj_len * sizeof fifo->obj[0]);
+    }
+
+    // Same order as gfx->layers.
+    uint8_t* background = &fifo->line[0][fifo->lx];
+    uint8_t* sprites_bg = &fifo->line[1][fifo->lx];
+    uint8_t* sprites_fg = &fifo->line[2][fifo->lx];
+
+    *background = lcdc_background_enabled(mem) ?
+        graphics_palette_decode(mem->io.BGP).colors[color] : 0;
+    *sprites_bg = *sprites_fg = 0;
+
+    if (obj.color != 0 && lcdc_sprites_enabled(mem)) {
+        const palette_t palette = graphics_palette_decode(obj.high_palette ?
+            mem->io.SPP_HIGH : mem->io.SPP_LOW);
+
+        *(obj.in_background ? sprites_bg : sprites_fg) =
+            palette.colors[obj.color];
+    }
+
+    if (++fifo->lx == SCREEN_WIDTH) {
+        transfer_end(ctx);
+    }
+}
+
+static void
+transfer_dot(context_t *ctx)
+{
+    fifo_t *fifo = &ctx->gfx.fifo;
+
+    if (fifo->obj_fetch > 0) {
+        // Pixel output and the background fetcher wait for the sprite.
+        if (--fifo->obj_fetch == 0 && !ctx->gfx.skip_frame) {
+            sprite_fetch(ctx, &fifo->sprites[fifo->obj_index]);
+        }
+        return;
+    }
+
+    if (window_due(ctx)) {
+        window_start(ctx);
+    }
+
+    if (fifo->bg_len > 0) {
+        if (fifo->discard == 0 && sprite_due(ctx)) {
+            fifo->obj_fetch = FETCH_DOTS - 1;
+            return;
+        }
+
+        pixel_output(ctx);
+
+        if (ctx->gfx.state != TRANSF) {
+            return;
+        }
+    }
+
+    fetcher_tick(ctx);
+}
+
+static void
+fifo_dot(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+    fifo_t *fifo = &gfx->fifo;
+
+    if (fifo->dot == 0) {
+        line_start(ctx);
+    }
+
+    if (ctx->mem.io.LY < SCREEN_HEIGHT) {
+        if (fifo->dot == OAM_DOTS) {
+            transfer_start(ctx);
+        }
+
+        if (gfx->state == TRANSF) {
+            transfer_dot(ctx);
+        }
+    }
+
+    if (++fifo->dot < DOTS_PER_LINE) {
+        return;
+    }
+
+    fifo->dot = 0;
+
+    if (++ctx->mem.io.LY == LINES_PER_FRAME) {
+        ctx->mem.io.LY = 0;
+        fifo->window_triggered = false;
+        graphics_frame_start(ctx);
+
+        if (ctx->stopflags & STOP_FRAME) {
+            ctx->state = FRAME_STEPPED;
+            ctx->stopflags &= ~STOP_FRAME;
+        }
+    }
+}
+
+static void
+fifo_update(context_t *ctx, int cycles)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    if (!lcdc_display_enabled(&ctx->mem)) {
+        if (!gfx->fifo.lcd_off) {
+            // LY stays 0 and the mode 0 while the LCD is off, without
+            // any interrupts.
+            gfx->fifo.lcd_off = true;
+            gfx->state = HBLANK;
+            ctx->mem.io.LY = 0;
+            ctx->mem.io.STAT &= ~0x3;
+        }
+
+        return;
+    }
+
+    if (gfx->fifo.lcd_off) {
+        // Turning the LCD back on starts a new frame.
+        fifo_reset(ctx);
+        graphics_frame_start(ctx);
+    }
+
+    for (; cycles > 0; cycles--) {
+        fifo_dot(ctx);
+    }
+}
+
+/*
+ * Lines are drawn while they are displayed, so writes take effect right
+ * away. Only the cached planes need to be kept up to date.
+ */
+static void
+fifo_write(context_t *ctx, uint16_t addr, uint8_t value)
+{
+    (void)value;
+
+    graphics_track_vram(&ctx->gfx, addr);
+}
+
+const gfx_backend_t gfx_fifo_backend = {
+    .update = fifo_update,
+    .write = fifo_write,
+    .reset = fifo_reset,
+};
@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "graphics/observe.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Shades of the color indexes, without debug colors.
+static const uint8_t shades[] = { 0xFF, 0xCC, 0x77, 0x00 };
+
+/*
+ * Maps <from> source pixels onto <to> destination pixels, each source
+ * pixel belongs to exactly one destination pixel.
+ */
+static void
+map_axis(uint8_t dst[], uint8_t sizes[], size_t from, size_t to)
+{
+    memset(sizes, 0, from);
+
+    for (size_t i = 0; i < from; i++) {
+        dst[i] = i * to / from;
+        sizes[dst[i]]++;
+    }
+}
+
+/*
+ * Sets up observations of <width> x <height> pixels, downsampled from
+ * the screen by averaging. With <max_pool>, every screen pixel is the
+ * darker one of the current and the previous emulated frame, which hides
+ * sprites flickering between frames.
+ */
+bool
+observer_init(observer_t* obs, observation_format_t format, size_t width,
+    size_t height, bool max_pool)
+{
+    memset(obs, 0, sizeof *obs);
+
+    if (format == OBSERVE_NONE) {
+        return true;
+    }
+
+    if (width == 0 || width > SCREEN_WIDTH ||
+        height == 0 || height > SCREEN_HEIGHT)
+    {
+        return false;
+    }
+
+    if (format == OBSERVE_2BPP && (width * height) % 4 != 0) {
+        return false;
+    }
+
+    obs->format   = format;
+    obs->width    = width;
+    obs->height   = height;
+    obs->max_pool = max_pool;
+
+    map_axis(obs->columns, obs->column_sizes, SCREEN_WIDTH, width);
+    map_axis(obs->rows, obs->row_sizes, SCREEN_HEIGHT, height);
+
+    return true;
+}
+
+size_t
+observer_size(const observer_t* obs)
+{
+    size_t pixels = obs->width * obs->height;
+
+    return obs->format == OBSERVE_2BPP ? pixels / 4 : pixels;
+}
+
+static void
+emit_row(observer_t* obs, size_t row)
+{
+    const uint32_t row_size = obs->row_sizes[row];
+
+    for (size_t x = 0; x < obs->width; x++) {
+        const uint32_t n = row_size * obs->column_sizes[x];
+        const uint8_t value = (obs->sums[x] + n / 2) / n;
+        const size_t i = row * obs->width + x;
+
+        if (obs->format == OBSERVE_GREY) {
+            obs->pixels[i] = value;
+        } else if (i % 4 == 0) {
+            obs->pixels[i / 4] = value << 6;
+        } else {
+            obs->pixels[i / 4] |= value << (6 - 2 * (i % 4));
+        }
+    }
+
+    memset(obs->sums, 0, obs->width * sizeof obs->sums[0]);
+}
+
+/*
+ * Whether skipped frames have to be drawn into obs->previous, because
+ * the next frame is pooled with them.
+ */
+bool
+observer_wants_previous(const observer_t* obs)
+{
+    return obs->format != OBSERVE_NONE && obs->max_pool;
+}
+
+/*
+ * Adds screen line <y> of color indexes to the observation.
+ */
+void
+observer_line(observer_t* obs, const uint8_t* line, size_t y)
+{
+    if (obs->format == OBSERVE_NONE) {
+        return;
+    }
+
+    for (size_t x = 0; x < SCREEN_WIDTH; x++) {
+        uint8_t color = line[x] & 3;
+
+        if (obs->max_pool) {
+            color = MAX(color, obs->previous[y][x] & 3);
+            obs->previous[y][x] = line[x];
+        }
+
+        obs->sums[obs->columns[x]] +=
+            obs->format == OBSERVE_GREY ? shades[color] : color;
+    }
+
+    // The last screen line of a destination row completes it.
+    if (y + 1 == SCREEN_HEIGHT || obs->rows[y + 1] != obs->rows[y]) {
+        emit_row(obs, obs->rows[y]);
+    }
+}
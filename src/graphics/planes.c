@@ -0,0 +1,101 @@
+#include <assert.h>
+#include <string.h>
+
+#include "graphics/planes.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/*
+ * Forces every tile of the plane to be redrawn on next use. Version 0 is
+ * never used by gfx->vram_version.
+ */
+void
+plane_invalidate(plane_t* plane)
+{
+    memset(plane->tiles, 0xFF, sizeof plane->tiles);
+    plane->vram_version = 0;
+}
+
+/*
+ * Returns the fully rendered plane of a tile map. Only the tiles whose
+ * map entry or tile data changed since the last call are redrawn, which
+ * is usually none of them.
+ */
+const plane_t*
+plane_get(gfx_t* gfx, const memory_t* mem, tile_map_t tile_map)
+{
+    static const palette_t identity = {
+        {0, 1, 2, 3}
+    };
+
+    plane_t* plane = &gfx->planes[tile_map];
+    const bool signed_ids = !lcdc_unsigned_tile_ids(mem);
+
+    if (plane->vram_version == gfx->vram_version &&
+        plane->signed_ids == signed_ids)
+    {
+        return plane;
+    }
+
+    const memory_tile_map_t* map = &mem->gfx.tile_maps[tile_map];
+
+    for (size_t row = 0; row < MAP_ROWS; row++) {
+        for (size_t col = 0; col < MAP_COLUMNS; col++) {
+            const uint8_t tile_id = map->data[row][col];
+            const uint16_t index = signed_ids ? 256 + (int8_t)tile_id : tile_id;
+
+            assert(index < MAX_TILES);
+
+            if (plane->tiles[row][col] == index &&
+                plane->versions[row][col] == gfx->tile_versions[index])
+            {
+                continue;
+            }
+
+            for (size_t y = 0; y < TILE_HEIGHT; y++) {
+                source_t src;
+                dest_t dst = {
+                    .data = &plane->pixels[row * TILE_HEIGHT + y][col * TILE_WIDTH],
+                    .remaining = TILE_WIDTH,
+                };
+
+                source_init(&src, &mem->gfx.tiles.data[index], 0, y);
+                draw_tile(&dst, &src, identity);
+            }
+
+            plane->tiles[row][col] = index;
+            plane->versions[row][col] = gfx->tile_versions[index];
+        }
+    }
+
+    plane->vram_version = gfx->vram_version;
+    plane->signed_ids = signed_ids;
+
+    return plane;
+}
+
+/*
+ * Copies a line from a plane, starting at x/y and wrapping around at the
+ * right edge, until dst is full. Planes hold color indexes, which are
+ * mapped through <palette> on the way.
+ */
+void
+plane_draw_line(dest_t* restrict dst, const plane_t* restrict plane,
+    size_t x, size_t y, palette_t palette)
+{
+    const uint8_t* line = plane->pixels[y % MAP_HEIGHT];
+
+    x %= MAP_WIDTH;
+
+    while (dst->remaining > 0) {
+        const size_t num = MIN(dst->remaining, MAP_WIDTH - x);
+
+        for (size_t i = 0; i < num; i++) {
+            dst->data[i] = palette.colors[line[x + i]];
+        }
+
+        dst->data += num;
+        dst->remaining -= num;
+        x = 0;
+    }
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/record.h"
+#include "graphics/scale.h"
+#include "timers.h"
+
+#define FRAME_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+// Queued items are the frame hash followed by the pixels.
+#define ITEM_SIZE (sizeof(uint64_t) + FRAME_PIXELS)
+
+// Frames that may be waiting for the disk, about a second worth.
+#define RECORD_QUEUE (64)
+
+#define Y4M_FRAME "FRAME\n"
+
+// Shades of the color indexes, without debug colors.
+static const uint8_t shades[] = { 0xFF, 0xCC, 0x77, 0x00 };
+
+/*
+ * The pixels of <item>, scaled. Returns the number of pixels in <len>.
+ */
+static const uint8_t*
+scaled_pixels(recorder_t* recorder, const uint8_t* item, size_t* len)
+{
+    uint64_t hash;
+
+    memcpy(&hash, item, sizeof hash);
+    *len = recorder->scaler.width * recorder->scaler.height;
+
+    return scaler_apply(&recorder->scaler, item + sizeof hash, hash);
+}
+
+/*
+ * Y4M with a single luma plane, see Cmono in the stream header.
+ */
+static size_t encode_y4m(void* user, const uint8_t* item, uint8_t* dst)
+{
+    size_t len;
+    const uint8_t* pixels = scaled_pixels(user, item, &len);
+
+    memcpy(dst, Y4M_FRAME, sizeof(Y4M_FRAME) - 1);
+    dst += sizeof(Y4M_FRAME) - 1;
+
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = shades[pixels[i] & 3];
+    }
+
+    return sizeof(Y4M_FRAME) - 1 + len;
+}
+
+/*
+ * Four pixels per byte, the leftmost one in the upper bits.
+ */
+static size_t encode_2bpp(void* user, const uint8_t* item, uint8_t* dst)
+{
+    size_t len;
+    const uint8_t* pixels = scaled_pixels(user, item, &len);
+
+    for (size_t i = 0; i < len; i += 4) {
+        *dst++ = (pixels[i] & 3) << 6 | (pixels[i + 1] & 3) << 4 |
+            (pixels[i + 2] & 3) << 2 | (pixels[i + 3] & 3);
+    }
+
+    return len / 4;
+}
+
+/*
+ * One binary PPM per frame, concatenated like a netpbm multi-image file.
+ */
+static size_t encode_ppm(void* user, const uint8_t* item, uint8_t* dst)
+{
+    recorder_t* recorder = user;
+    size_t len;
+    const uint8_t* pixels = scaled_pixels(recorder, item, &len);
+
+    memcpy(dst, recorder->ppm_header, recorder->ppm_header_len);
+    dst += recorder->ppm_header_len;
+
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t shade = shades[pixels[i] & 3];
+
+        *dst++ = shade;
+        *dst++ = shade;
+        *dst++ = shade;
+    }
+
+    return recorder->ppm_header_len + 3 * len;
+}
+
+/*
+ * Starts recording every <every>th frame to <filename>, 0 or 1 record
+ * all of them. Frames are scaled by <factor> with <filter> first, see
+ * scaler_init.
+ */
+recorder_t* recorder_open(const char* filename, record_format_t format,
+    unsigned int every, scale_filter_t filter, unsigned int factor)
+{
+    char header[64];
+    size_t header_len = 0;
+    writer_encode_t encode;
+    size_t max_encoded;
+
+    recorder_t* recorder = malloc(sizeof *recorder);
+
+    if (recorder == NULL) {
+        return NULL;
+    }
+
+    if (!scaler_init(&recorder->scaler, filter, factor)) {
+        free(recorder);
+        return NULL;
+    }
+
+    const size_t width = recorder->scaler.width;
+    const size_t height = recorder->scaler.height;
+
+    every = every > 1 ? every : 1;
+
+    switch (format) {
+    case RECORD_Y4M:
+        // CLOCKSPEED / 70224 cycles per frame, about 59.73 fps.
+        header_len = snprintf(header, sizeof header,
+            "YUV4MPEG2 W%zu H%zu F%d:%u Ip A1:1 Cmono\n",
+            width, height, CLOCKSPEED / 16, 70224 / 16 * every);
+        encode = encode_y4m;
+        max_encoded = sizeof(Y4M_FRAME) - 1 + width * height;
+        break;
+
+    case RECORD_2BPP:
+        encode = encode_2bpp;
+        max_encoded = width * height / 4;
+        break;
+
+    case RECORD_PPM:
+        recorder->ppm_header_len = snprintf(recorder->ppm_header,
+            sizeof recorder->ppm_header, "P6\n%zu %zu\n255\n", width, height);
+        encode = encode_ppm;
+        max_encoded = recorder->ppm_header_len + 3 * width * height;
+        break;
+
+    default:
+        goto error;
+    }
+
+    recorder->writer = writer_open(filename, header, header_len,
+        ITEM_SIZE, RECORD_QUEUE, encode, max_encoded, recorder);
+
+    if (recorder->writer == NULL) {
+        goto error;
+    }
+
+    recorder->format = format;
+    recorder->every = every;
+    recorder->until_recorded = 0;
+
+    return recorder;
+
+    error: {
+        scaler_destroy(&recorder->scaler);
+        free(recorder);
+        return NULL;
+    }
+}
+
+/*
+ * Queues <frame> if it is due, never waits for the disk.
+ */
+void recorder_push(recorder_t* recorder, const frame_t* frame)
+{
+    if (recorder->until_recorded > 0) {
+        recorder->until_recorded--;
+        return;
+    }
+
+    recorder->until_recorded = recorder->every - 1;
+
+    uint8_t* item = writer_reserve(recorder->writer);
+
+    if (item != NULL) {
+        memcpy(item, &frame->hash, sizeof frame->hash);
+        memcpy(item + sizeof frame->hash, frame->pixels, FRAME_PIXELS);
+        writer_commit(recorder->writer);
+    }
+}
+
+/*
+ * Writes all queued frames. Returns false if any frame was lost.
+ */
+bool recorder_close(recorder_t* recorder)
+{
+    bool ok = writer_close(recorder->writer);
+
+    scaler_destroy(&recorder->scaler);
+    free(recorder);
+
+    return ok;
+}
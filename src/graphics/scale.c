@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "graphics/scale.h"
+
+#define MAX_FACTOR (8)
+
+// Padded sources have this many extra pixels left and right of each
+// row, and one extra row above and below. Neighbours of the first and
+// last pixels can be loaded without bounds checks.
+#define PAD (16)
+
+// Index distance of two pixels.
+#define DIST(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
+
+typedef void (*pass_t)(uint8_t* restrict dst, const uint8_t* restrict src,
+    size_t width, size_t height);
+
+#if defined(__SSE2__)
+static inline __m128i load(const uint8_t* src)
+{
+    return _mm_loadu_si128((const __m128i*)src);
+}
+
+static inline void store(uint8_t* dst, __m128i value)
+{
+    _mm_storeu_si128((__m128i*)dst, value);
+}
+
+// Picks bytes of <a> where <mask> is set, bytes of <b> elsewhere.
+static inline __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i dist(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+// Stores a row of <left> and <right> pixels interleaved.
+static inline void store_pairs(uint8_t* dst, __m128i left, __m128i right)
+{
+    store(dst, _mm_unpacklo_epi8(left, right));
+    store(dst + 16, _mm_unpackhi_epi8(left, right));
+}
+#endif
+
+/*
+ * Repeats each of <width> pixels <factor> times.
+ */
+static void
+expand_row(uint8_t* restrict dst, const uint8_t* restrict src, size_t width,
+    unsigned int factor)
+{
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    if (factor == 2 || factor == 4 || factor == 8) {
+        for (; x + 16 <= width; x += 16) {
+            __m128i v[8] = { load(src + x) };
+            size_t n = 1;
+
+            // Each round doubles every pixel, back to front so that
+            // no vector is overwritten before it was expanded.
+            for (unsigned int f = 1; f < factor; f *= 2, n *= 2) {
+                for (size_t i = n; i-- > 0;) {
+                    v[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[i]);
+                    v[2 * i] = _mm_unpacklo_epi8(v[i], v[i]);
+                }
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                store(dst + x * factor + 16 * i, v[i]);
+            }
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        memset(dst + x * factor, src[x], factor);
+    }
+}
+
+static void
+nearest(uint8_t* restrict dst, const uint8_t* restrict src, size_t width,
+    size_t height, unsigned int factor)
+{
+    const size_t dst_width = width * factor;
+
+    for (size_t y = 0; y < height; y++) {
+        uint8_t* row = dst + y * factor * dst_width;
+
+        expand_row(row, src + y * width, width, factor);
+
+        for (size_t i = 1; i < factor; i++) {
+            memcpy(row + i * dst_width, row, dst_width);
+        }
+    }
+}
+
+/*
+ * Copies <src> into <dst>, surrounded by PAD copies of the edge pixels.
+ */
+static void
+pad(uint8_t* restrict dst, const uint8_t* restrict src, size_t width,
+    size_t height)
+{
+    const size_t stride = width + 2 * PAD;
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* line = src + y * width;
+        uint8_t* row = dst + (y + 1) * stride;
+
+        memset(row, line[0], PAD);
+        memcpy(row + PAD, line, width);
+        memset(row + PAD + width, line[width - 1], PAD);
+    }
+
+    memcpy(dst, dst + stride, stride);
+    memcpy(dst + (height + 1) * stride, dst + height * stride, stride);
+}
+
+/*
+ * Scale2x: each pixel E becomes four, which take the color of two equal
+ * neighbours they touch, unless E sits on a straight line.
+ *
+ *   A B C    E0 E1
+ *   D E F    E2 E3
+ *   G H I
+ */
+static void
+scale2x(uint8_t* restrict dst, const uint8_t* restrict src, size_t width,
+    size_t height)
+{
+    const size_t stride = width + 2 * PAD;
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* e = src + (y + 1) * stride + PAD;
+        const uint8_t* b = e - stride;
+        const uint8_t* h = e + stride;
+        uint8_t* top = dst + 2 * y * 2 * width;
+        uint8_t* bottom = top + 2 * width;
+        size_t x = 0;
+
+#if defined(__SSE2__)
+        for (; x + 16 <= width; x += 16) {
+            const __m128i B = load(b + x), H = load(h + x);
+            const __m128i D = load(e + x - 1), E = load(e + x);
+            const __m128i F = load(e + x + 1);
+            const __m128i edge = _mm_andnot_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(B, H), _mm_cmpeq_epi8(D, F)),
+                _mm_set1_epi8(-1));
+
+            store_pairs(top + 2 * x,
+                select(_mm_and_si128(edge, _mm_cmpeq_epi8(D, B)), D, E),
+                select(_mm_and_si128(edge, _mm_cmpeq_epi8(B, F)), F, E));
+            store_pairs(bottom + 2 * x,
+                select(_mm_and_si128(edge, _mm_cmpeq_epi8(D, H)), D, E),
+                select(_mm_and_si128(edge, _mm_cmpeq_epi8(H, F)), F, E));
+        }
+#endif
+
+        for (; x < width; x++) {
+            const uint8_t B = b[x], D = e[x - 1], E = e[x], F = e[x + 1];
+            const uint8_t H = h[x];
+            const bool edge = B != H && D != F;
+
+            top[2 * x]        = edge && D == B ? D : E;
+            top[2 * x + 1]    = edge && B == F ? F : E;
+            bottom[2 * x]     = edge && D == H ? D : E;
+            bottom[2 * x + 1] = edge && H == F ? F : E;
+        }
+    }
+}
+
+/*
+ * Scale3x, the same idea with nine pixels. The middle ones also follow
+ * the neighbours if that continues a line.
+ */
+static void
+scale3x(uint8_t* restrict dst, const uint8_t* restrict src, size_t width,
+    size_t height)
+{
+    const size_t stride = width + 2 * PAD;
+    const size_t dst_width = 3 * width;
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* e = src + (y + 1) * stride + PAD;
+        const uint8_t* b = e - stride;
+        const uint8_t* h = e + stride;
+        uint8_t* out = dst + 3 * y * dst_width;
+
+        for (size_t x = 0; x < width; x++) {
+            const uint8_t A = b[x - 1], B = b[x], C = b[x + 1];
+            const uint8_t D = e[x - 1], E = e[x], F = e[x + 1];
+            const uint8_t G = h[x - 1], H = h[x], I = h[x + 1];
+            uint8_t* p = out + 3 * x;
+
+            if (B == H || D == F) {
+                memset(p, E, 3);
+                memset(p + dst_width, E, 3);
+                memset(p + 2 * dst_width, E, 3);
+                continue;
+            }
+
+            p[0] = D == B ? D : E;
+            p[1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+            p[2] = B == F ? F : E;
+            p += dst_width;
+            p[0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+            p[1] = E;
+            p[2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+            p += dst_width;
+            p[0] = D == H ? D : E;
+            p[1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+            p[2] = H == F ? F : E;
+        }
+    }
+}
+
+/*
+ * Doubles the size like Scale2x, but decides which corners to round off
+ * by comparing the index gradients along both diagonals around E. A
+ * corner takes the color of its two equal neighbours if the edge between
+ * them runs along the weaker gradient. Colors are never blended, so the
+ * result still consists of color indexes.
+ */
+static void
+edge2x(uint8_t* restrict dst, const uint8_t* restrict src, size_t width,
+    size_t height)
+{
+    const size_t stride = width + 2 * PAD;
+
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* e = src + (y + 1) * stride + PAD;
+        const uint8_t* b = e - stride;
+        const uint8_t* h = e + stride;
+        uint8_t* top = dst + 2 * y * 2 * width;
+        uint8_t* bottom = top + 2 * width;
+        size_t x = 0;
+
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; x + 16 <= width; x += 16) {
+            const __m128i A = load(b + x - 1), B = load(b + x);
+            const __m128i C = load(b + x + 1), D = load(e + x - 1);
+            const __m128i E = load(e + x), F = load(e + x + 1);
+            const __m128i G = load(h + x - 1), H = load(h + x);
+            const __m128i I = load(h + x + 1);
+
+            const __m128i anti = _mm_adds_epu8(
+                _mm_adds_epu8(dist(G, E), dist(E, C)),
+                _mm_adds_epu8(dist(D, B), dist(H, F)));
+            const __m128i diag = _mm_adds_epu8(
+                _mm_adds_epu8(dist(A, E), dist(E, I)),
+                _mm_adds_epu8(dist(D, H), dist(B, F)));
+
+            // Saturating subtraction leaves non-zero bytes where the
+            // first operand is larger.
+            const __m128i along_anti = _mm_andnot_si128(
+                _mm_cmpeq_epi8(_mm_subs_epu8(diag, anti), zero),
+                _mm_set1_epi8(-1));
+            const __m128i along_diag = _mm_andnot_si128(
+                _mm_cmpeq_epi8(_mm_subs_epu8(anti, diag), zero),
+                _mm_set1_epi8(-1));
+
+            store_pairs(top + 2 * x,
+                select(_mm_and_si128(along_anti, _mm_cmpeq_epi8(D, B)),
+                    D, E),
+                select(_mm_and_si128(along_diag, _mm_cmpeq_epi8(B, F)),
+                    F, E));
+            store_pairs(bottom + 2 * x,
+                select(_mm_and_si128(along_diag, _mm_cmpeq_epi8(D, H)),
+                    D, E),
+                select(_mm_and_si128(along_anti, _mm_cmpeq_epi8(H, F)),
+                    F, E));
+        }
+#endif
+
+        for (; x < width; x++) {
+            const uint8_t A = b[x - 1], B = b[x], C = b[x + 1];
+            const uint8_t D = e[x - 1], E = e[x], F = e[x + 1];
+            const uint8_t G = h[x - 1], H = h[x], I = h[x + 1];
+
+            const unsigned int anti = DIST(G, E) + DIST(E, C) +
+                DIST(D, B) + DIST(H, F);
+            const unsigned int diag = DIST(A, E) + DIST(E, I) +
+                DIST(D, H) + DIST(B, F);
+
+            top[2 * x]        = anti < diag && D == B ? D : E;
+            top[2 * x + 1]    = diag < anti && B == F ? F : E;
+            bottom[2 * x]     = diag < anti && D == H ? D : E;
+            bottom[2 * x + 1] = anti < diag && H == F ? F : E;
+        }
+    }
+}
+
+static bool valid_factor(scale_filter_t filter, unsigned int factor)
+{
+    if (factor < 1 || factor > MAX_FACTOR) {
+        return false;
+    }
+
+    switch (filter) {
+    case SCALE_NEAREST:
+        return true;
+
+    case SCALE_SCALE2X:
+        // Any combination of 2x and 3x passes.
+        while (factor % 2 == 0) {
+            factor /= 2;
+        }
+        while (factor % 3 == 0) {
+            factor /= 3;
+        }
+        return factor == 1;
+
+    case SCALE_EDGE:
+        return (factor & (factor - 1)) == 0;
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Sets up scaling of frames by <factor> in both directions. Nearest
+ * neighbour takes factors up to MAX_FACTOR, Scale2x products of 2 and 3,
+ * the edge filter powers of 2. A factor of 1 leaves frames alone.
+ */
+bool scaler_init(scaler_t* scaler, scale_filter_t filter,
+    unsigned int factor)
+{
+    memset(scaler, 0, sizeof *scaler);
+
+    if (!valid_factor(filter, factor)) {
+        return false;
+    }
+
+    scaler->filter = filter;
+    scaler->factor = factor;
+    scaler->width  = SCREEN_WIDTH * factor;
+    scaler->height = SCREEN_HEIGHT * factor;
+
+    if (factor == 1) {
+        return true;
+    }
+
+    scaler->pixels = malloc(scaler->width * scaler->height);
+
+    if (scaler->pixels == NULL) {
+        return false;
+    }
+
+    if (filter == SCALE_NEAREST) {
+        return true;
+    }
+
+    // The source of the last pass is at most half as large as the result.
+    scaler->padded = malloc((scaler->width / 2 + 2 * PAD) *
+        (scaler->height / 2 + 2));
+
+    if (scaler->padded == NULL) {
+        scaler_destroy(scaler);
+        return false;
+    }
+
+    return true;
+}
+
+void scaler_destroy(scaler_t* scaler)
+{
+    free(scaler->pixels);
+    free(scaler->padded);
+    scaler->pixels = NULL;
+    scaler->padded = NULL;
+    scaler->valid = false;
+}
+
+/*
+ * Returns <frame> scaled, scaler->width x scaler->height color indexes.
+ * <hash> identifies the frame, if it is the same as last time the
+ * previous result is returned right away. Stays valid until the next
+ * call.
+ */
+const uint8_t* scaler_apply(scaler_t* scaler, const uint8_t* frame,
+    uint64_t hash)
+{
+    if (scaler->factor == 1) {
+        return frame;
+    }
+
+    if (scaler->valid && scaler->hash == hash) {
+        return scaler->pixels;
+    }
+
+    if (scaler->filter == SCALE_NEAREST) {
+        nearest(scaler->pixels, frame, SCREEN_WIDTH, SCREEN_HEIGHT,
+            scaler->factor);
+    } else {
+        const uint8_t* src = frame;
+        size_t width = SCREEN_WIDTH, height = SCREEN_HEIGHT;
+
+        // Smaller passes first, each one reads a padded copy of the
+        // previous result, so they can all write to scaler->pixels.
+        for (unsigned int left = scaler->factor; left > 1;) {
+            const unsigned int factor = left % 2 == 0 ? 2 : 3;
+            const pass_t pass = scaler->filter == SCALE_EDGE ? edge2x :
+                factor == 2 ? scale2x : scale3x;
+
+            pad(scaler->padded, src, width, height);
+            pass(scaler->pixels, scaler->padded, width, height);
+
+            src = scaler->pixels;
+            width *= factor;
+            height *= factor;
+            left /= factor;
+        }
+    }
+
+    scaler->hash = hash;
+    scaler->valid = true;
+    scaler->scaled++;
+
+    return scaler->pixels;
+}
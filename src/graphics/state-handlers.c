@@ -5,13 +5,12 @@
 #include "context.h"
 #include "cpu.h"
 #include "ioregs.h"
-
-void draw_line(context_t *ctx);
+#include "graphics/observe.h"
 
 /*
  * Sets a new LCD state and requests an interrupt if appropriate.
  */
-static inline void set_mode(context_t *ctx, gfx_state_t state)
+void graphics_set_mode(context_t *ctx, gfx_state_t state)
 {
     ctx->gfx.state = state;
 
@@ -25,6 +24,62 @@ static inline void set_mode(context_t *ctx, gfx_state_t state)
     }
 }
 
+/*
+ * Decides whether the frame that is about to be displayed is drawn.
+ */
+void graphics_frame_start(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    if (gfx->hidden) {
+        gfx->skip_frame = true;
+    } else {
+        gfx->skip_frame = gfx->frames_until_drawn > 0;
+
+        if (gfx->skip_frame) {
+            gfx->frames_until_drawn--;
+        } else {
+            gfx->frames_until_drawn =
+                gfx->frame_skip > 1 ? gfx->frame_skip - 1 : 0;
+        }
+    }
+
+    // Max pooling needs the frame before each drawn one. Which hidden
+    // frame that is depends on where run-ahead stops, so all of them
+    // are drawn.
+    gfx->pooled = gfx->skip_frame &&
+        observer_wants_previous(&gfx->observer) &&
+        (gfx->hidden || gfx->frames_until_drawn == 0);
+
+    if (gfx->pooled) {
+        gfx->skip_frame = false;
+    }
+
+    gfx->next_line = gfx->skip_frame ? SCREEN_HEIGHT : 0;
+}
+
+/*
+ * Draws or skips the finished frame and enters VBLANK.
+ */
+void graphics_frame_end(context_t *ctx)
+{
+    gfx_t *gfx = &ctx->gfx;
+
+    if (gfx->skip_frame) {
+        gfx->frames_skipped++;
+    } else if (gfx->pooled) {
+        graphics_pool(ctx);
+        gfx->frames_skipped++;
+    } else {
+        graphics_present(ctx);
+        gfx->frames_drawn++;
+    }
+
+    cpu_irq(ctx, I_VBLANK);
+
+    gfx->window_y = 0;
+}
+
 void oam(context_t *ctx)
 {
     ctx->gfx.state = OAM_WAIT;
@@ -46,32 +101,17 @@ void oam(context_t *ctx)
 
 void hblank(context_t *ctx)
 {
-    draw_line(ctx);
+    // Lines are drawn on VBLANK, see graphics_write.
     ctx->mem.io.LY++;
     ctx->gfx.state = HBLANK_WAIT;
 }
 
 void vblank(context_t *ctx)
 {
-    gfx_t *gfx = &ctx->gfx;
-
-    window_clear(&gfx->window);
-
-    SDL_BlitSurface(gfx->sprites_bg, NULL, gfx->window.surface, NULL);
-    SDL_BlitSurface(gfx->background, NULL, gfx->window.surface, NULL);
-    SDL_BlitSurface(gfx->sprites_fg, NULL, gfx->window.surface, NULL);
-
-    window_draw(&gfx->window);
+    graphics_catch_up(ctx, SCREEN_HEIGHT);
+    graphics_frame_end(ctx);
 
-    // Make overlays transparent again
-    SDL_FillRect(gfx->sprites_bg, NULL, 0x00);
-    SDL_FillRect(gfx->background, NULL, 0x00);
-    SDL_FillRect(gfx->sprites_fg, NULL, 0x00);
-
-    cpu_irq(ctx, I_VBLANK);
-
-    gfx->state = VBLANK_WAIT;
-    gfx->window_y = 0;
+    ctx->gfx.state = VBLANK_WAIT;
 }
 
 void oam_wait(context_t *ctx)
@@ -79,7 +119,7 @@ void oam_wait(context_t *ctx)
     if (ctx->gfx.cycles >= 80)
     {
         ctx->gfx.cycles -= 80;
-        set_mode(ctx, TRANSF);
+        graphics_set_mode(ctx, TRANSF);
     }
 }
 
@@ -88,7 +128,7 @@ void transf(context_t *ctx)
     if (ctx->gfx.cycles >= 172)
     {
         ctx->gfx.cycles -= 172;
-        set_mode(ctx, HBLANK);
+        graphics_set_mode(ctx, HBLANK);
     }
 }
 
@@ -99,11 +139,11 @@ void hblank_wait(context_t *ctx)
         ctx->gfx.cycles -= 204;
         if (ctx->mem.io.LY == 144)
         {
-            set_mode(ctx, VBLANK);
+            graphics_set_mode(ctx, VBLANK);
         }
         else
         {
-            set_mode(ctx, OAM);
+            graphics_set_mode(ctx, OAM);
         }
     }
 }
@@ -117,7 +157,8 @@ void vblank_wait(context_t *ctx)
         if (ctx->mem.io.LY++ == 153)
         {
             ctx->mem.io.LY = 0;
-            set_mode(ctx, OAM);
+            graphics_frame_start(ctx);
+            graphics_set_mode(ctx, OAM);
 
             if (ctx->stopflags & STOP_FRAME) {
                 ctx->state = FRAME_STEPPED;
@@ -1,51 +1,9 @@
 #include <assert.h>
 
-#include "ioregs.h"
 #include "graphics/tiles.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-void
-map_init(map_t* map, const memory_t* mem, tile_map_t tile_map,
-    size_t x, size_t y)
-{
-    x %= MAP_WIDTH;
-    y %= MAP_HEIGHT;
-
-    map->signed_ids = !lcdc_unsigned_tile_ids(mem);
-
-    map->tile_map  = &mem->gfx.tile_maps[tile_map];
-    map->tile_data = &mem->gfx.tiles;
-
-    map->row    = y / TILE_HEIGHT;
-    map->col    = x / TILE_WIDTH;
-    map->tile_y = y % TILE_HEIGHT;
-    map->tile_x = x % TILE_WIDTH;
-}
-
-void
-map_next(map_t* map, source_t* src)
-{
-    uint8_t tile_id = map->tile_map->data[map->row][map->col];
-    size_t index;
-
-    if (map->signed_ids) {
-        index = 256 + (int8_t)tile_id;
-    } else {
-        index = tile_id;
-    }
-
-    assert(index < MAX_TILES);
-
-    src->tile = &map->tile_data->data[index];
-    src->x = map->tile_x;
-    src->y = map->tile_y;
-
-    // Only the first tile can have a non-zero x offset
-    map->tile_x = 0;
-    map->col = (map->col + 1) % MAP_COLUMNS;
-}
-
 void
 draw_tile(dest_t* restrict dst, const source_t* restrict src, palette_t palette)
 {
@@ -100,9 +58,10 @@ draw_tile(dest_t* restrict dst, const source_t* restrict src, palette_t palette)
     const size_t num = dst->remaining < TILE_WIDTH ?
         dst->remaining : TILE_WIDTH;
 
-    // Interleave bytes, to get continuous bits
-    const uint8_t line_high = src->tile->lines[src->y][0];
-    const uint8_t line_low  = src->tile->lines[src->y][1];
+    // Interleave bytes, to get continuous bits. The first byte holds
+    // the low bits of the color indexes.
+    const uint8_t line_low  = src->tile->lines[src->y][0];
+    const uint8_t line_high = src->tile->lines[src->y][1];
 
     const uint16_t line =
         (morton_table[line_high] << 1) | morton_table[line_low];
@@ -114,20 +73,6 @@ draw_tile(dest_t* restrict dst, const source_t* restrict src, palette_t palette)
     }
 }
 
-void
-draw_tiles(dest_t* restrict dst, const map_t* restrict map, palette_t palette)
-{
-    map_t my_map = *map;
-
-    // dst->remaining is updated by draw_tile
-    while (dst->remaining > 0) {
-        source_t src;
-
-        map_next(&my_map, &src);
-        draw_tile(dst, &src, palette);
-    }
-}
-
 void
 dest_init(dest_t* dst, SDL_Surface* surface, size_t x, size_t y, size_t num)
 {
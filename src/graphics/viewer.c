@@ -0,0 +1,212 @@
+#include <stdlib.h>
+
+#include "context.h"
+#include "ioregs.h"
+#include "graphics/viewer.h"
+
+#define CEIL(a, b) ((a + (b - 1)) / b)
+
+// Tiles and sprites are separated by a line of background color.
+#define TILES_PER_ROW (32)
+#define SPRITES_PER_ROW (10)
+
+static const struct {
+    const char* name;
+    int w, h;
+} layouts[] = {
+    [VIEW_TILES] = {
+        "Tiles",
+        TILES_PER_ROW * (TILE_WIDTH + 1),
+        CEIL(MAX_TILES, TILES_PER_ROW) * (TILE_HEIGHT + 1)
+    },
+    [VIEW_TILE_MAPS] = {
+        "Tile maps",
+        2 * MAP_WIDTH + TILE_WIDTH,
+        MAP_HEIGHT
+    },
+    [VIEW_OAM] = {
+        "OAM",
+        SPRITES_PER_ROW * (TILE_WIDTH + 1),
+        CEIL(MAX_SPRITES, SPRITES_PER_ROW) * (2 * TILE_HEIGHT + 1)
+    },
+};
+
+viewer_t* viewer_create(viewer_kind_t kind)
+{
+    viewer_t* viewer = malloc(sizeof *viewer);
+
+    if (viewer == NULL) {
+        return NULL;
+    }
+
+    if (!window_init(&viewer->window, layouts[kind].name, layouts[kind].w,
+        layouts[kind].h))
+    {
+        free(viewer);
+        return NULL;
+    }
+
+    graphics_map_colors(&viewer->window);
+    window_clear(&viewer->window);
+
+    viewer->kind = kind;
+    viewer->vram_version = 0;
+
+    return viewer;
+}
+
+void viewer_free(viewer_t* viewer)
+{
+    if (viewer != NULL) {
+        window_destroy(&viewer->window);
+        free(viewer);
+    }
+}
+
+static bool
+update_tiles(viewer_t* viewer, const gfx_t* gfx, const context_t* ctx)
+{
+    const bool all = viewer->vram_version == 0;
+    bool changed = false;
+
+    if (viewer->vram_version == gfx->vram_version) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < MAX_TILES; i++) {
+        if (!all && viewer->tile_versions[i] == gfx->tile_versions[i]) {
+            continue;
+        }
+
+        graphics_draw_tile(ctx, &viewer->window, i,
+            (i % TILES_PER_ROW) * (TILE_WIDTH + 1),
+            (i / TILES_PER_ROW) * (TILE_HEIGHT + 1));
+
+        viewer->tile_versions[i] = gfx->tile_versions[i];
+        changed = true;
+    }
+
+    return changed;
+}
+
+static bool
+update_tile_maps(viewer_t* viewer, const gfx_t* gfx, const context_t* ctx)
+{
+    const bool signed_ids = !lcdc_unsigned_tile_ids(&ctx->mem);
+    const bool all = viewer->vram_version == 0;
+    bool changed = false;
+
+    if (viewer->vram_version == gfx->vram_version &&
+        viewer->signed_ids == signed_ids)
+    {
+        return false;
+    }
+
+    for (size_t map = 0; map < 2; map++) {
+        const memory_tile_map_t* tile_map = &ctx->mem.gfx.tile_maps[map];
+
+        for (size_t row = 0; row < MAP_ROWS; row++) {
+            for (size_t col = 0; col < MAP_COLUMNS; col++) {
+                const uint8_t tile_id = tile_map->data[row][col];
+                const uint16_t index = signed_ids ?
+                    256 + (int8_t)tile_id : tile_id;
+
+                if (!all && viewer->map_tiles[map][row][col] == index &&
+                    viewer->map_versions[map][row][col] ==
+                        gfx->tile_versions[index])
+                {
+                    continue;
+                }
+
+                graphics_draw_tile(ctx, &viewer->window, index,
+                    map * (MAP_WIDTH + TILE_WIDTH) + col * TILE_WIDTH,
+                    row * TILE_HEIGHT);
+
+                viewer->map_tiles[map][row][col] = index;
+                viewer->map_versions[map][row][col] =
+                    gfx->tile_versions[index];
+                changed = true;
+            }
+        }
+    }
+
+    viewer->signed_ids = signed_ids;
+
+    return changed;
+}
+
+static bool
+update_oam(viewer_t* viewer, const gfx_t* gfx, const context_t* ctx)
+{
+    const size_t height = lcdc_sprite_height(&ctx->mem);
+    const bool all = viewer->vram_version == 0 ||
+        viewer->sprite_height != height;
+    bool changed = false;
+
+    // OAM is not covered by vram_version, but it is small enough to be
+    // compared every time.
+    for (size_t i = 0; i < MAX_SPRITES; i++) {
+        const uint8_t tile = ctx->mem.gfx.oam[i].data[2];
+        const size_t x = (i % SPRITES_PER_ROW) * (TILE_WIDTH + 1);
+        const size_t y = (i / SPRITES_PER_ROW) * (2 * TILE_HEIGHT + 1);
+
+        // 8x16 sprites consist of two tiles.
+        const size_t tiles = height / TILE_HEIGHT;
+        const uint16_t first = tiles > 1 ? tile & 0xFE : tile;
+
+        bool dirty = all || viewer->sprite_tiles[i] != tile;
+
+        for (size_t t = 0; t < tiles && !dirty; t++) {
+            dirty = viewer->sprite_versions[i][t] !=
+                gfx->tile_versions[first + t];
+        }
+
+        if (!dirty) {
+            continue;
+        }
+
+        SDL_Rect cell = { x, y, TILE_WIDTH, 2 * TILE_HEIGHT };
+        SDL_FillRect(viewer->window.surface, &cell, viewer->window.bg_color);
+
+        for (size_t t = 0; t < tiles; t++) {
+            graphics_draw_tile(ctx, &viewer->window, first + t,
+                x, y + t * TILE_HEIGHT);
+            viewer->sprite_versions[i][t] = gfx->tile_versions[first + t];
+        }
+
+        viewer->sprite_tiles[i] = tile;
+        changed = true;
+    }
+
+    viewer->sprite_height = height;
+
+    return changed;
+}
+
+/*
+ * Redraws whatever changed since the last update. The window is only
+ * presented if anything did, or if it lost its contents.
+ */
+void viewer_update(viewer_t* viewer, const context_t* ctx)
+{
+    const gfx_t* gfx = &ctx->gfx;
+    bool changed = false;
+
+    switch (viewer->kind) {
+        case VIEW_TILES:
+            changed = update_tiles(viewer, gfx, ctx);
+            break;
+        case VIEW_TILE_MAPS:
+            changed = update_tile_maps(viewer, gfx, ctx);
+            break;
+        case VIEW_OAM:
+            changed = update_oam(viewer, gfx, ctx);
+            break;
+    }
+
+    viewer->vram_version = gfx->vram_version;
+
+    if (atomic_exchange(&viewer->window.redraw, false) || changed) {
+        window_draw(&viewer->window);
+    }
+}
@@ -1,3 +1,6 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "context.h"
 #include "joypad.h"
 
@@ -6,6 +9,10 @@
 
 #define NUM(x) (sizeof (x) / sizeof (x)[0])
 
+// Games select a group and read it a few times in a row, usually more
+// than once per frame. Polling once for all of that is enough.
+#define POLL_INTERVAL (CYCLES_PER_FRAME / 16)
+
 static const struct {
     SDL_Scancode sdl_key;
     joypad_key_t key;
@@ -31,41 +38,207 @@ static joypad_key_t map_sdl_key(SDL_Scancode sdl_key)
     return KEY_INVALID;
 }
 
-static void
-state_to_ioreg(context_t *ctx, uint8_t state)
+/*
+ * Recomputes the low nibble of JOYPAD from the select bits and the
+ * button state. It only changes when either of them does, so this runs
+ * on writes and key events instead of after every instruction.
+ */
+static void update_ioreg(context_t *ctx)
 {
-    ctx->mem.io.JOYPAD &= 0xF0;
-    ctx->mem.io.JOYPAD |= (state & 0xF);
+    const uint8_t before = ctx->mem.io.JOYPAD;
+    uint8_t lines = 0xF;
+
+    // Active low, selecting both groups ANDs them together.
+    if (!(before & CONTROL_SELECTED))
+    {
+        lines &= ctx->joypad_state;
+    }
+
+    if (!(before & DIRECTION_SELECTED))
+    {
+        lines &= ctx->joypad_state >> 4;
+    }
+
+    ctx->mem.io.JOYPAD = (before & 0xF0) | lines;
+
+    // The interrupt is requested when one of the lines goes low.
+    if (before & ~lines & 0xF)
+    {
+        cpu_irq(ctx, I_JOYPAD);
+    }
 }
 
 void joypad_init(context_t *ctx)
 {
     ctx->joypad_state = 0xFF;
+    ctx->mem.io.JOYPAD |= 0xF;
+    update_ioreg(ctx);
+}
+
+void joypad_destroy(context_t *ctx)
+{
+    free(ctx->input.events);
+    ctx->input = (input_queue_t){ 0 };
 }
 
 void joypad_press(context_t* ctx, joypad_key_t key) {
     if (key != KEY_INVALID) {
         ctx->joypad_state &= ~key;
-        cpu_irq(ctx, I_JOYPAD);
+        update_ioreg(ctx);
     }
 }
 
 void joypad_release(context_t* ctx, joypad_key_t key) {
     ctx->joypad_state |= key;
+    update_ioreg(ctx);
+}
+
+/*
+ * Takes the keys straight from the keyboard state. This doesn't drain
+ * the event queue, so it is cheap enough to do in the middle of a frame.
+ * Keys pressed with joypad_press are overridden.
+ */
+void joypad_poll(context_t *ctx)
+{
+    uint8_t state = 0xFF;
+
+    SDL_PumpEvents();
+
+    const Uint8 *keys = SDL_GetKeyboardState(NULL);
+
+    for (size_t i = 0; i < NUM(keymap); i++) {
+        if (keys[keymap[i].sdl_key]) {
+            state &= ~keymap[i].key;
+        }
+    }
+
+    ctx->joypad_state = state;
+    ctx->joypad_polled = ctx->cycles;
+    update_ioreg(ctx);
+}
+
+/*
+ * Polls the keyboard right when the game selects a group, instead of only
+ * between frames, if enabled. Not available for headless contexts.
+ */
+void joypad_set_late_polling(context_t* ctx, bool enabled)
+{
+    ctx->late_polling = enabled && !ctx->headless;
+}
+
+bool joypad_get_late_polling(const context_t* ctx)
+{
+    return ctx->late_polling;
 }
 
-void joypad_update(context_t *ctx)
+/*
+ * Writes to JOYPAD. Only the select bits are writable. Games write them
+ * right before reading the buttons, which makes this the latest point
+ * to poll at if late polling is on.
+ */
+void joypad_write(context_t *ctx, uint8_t value)
 {
-    // Active low
-    if (!(ctx->mem.io.JOYPAD & CONTROL_SELECTED))
+    if (ctx->late_polling &&
+        ctx->cycles - ctx->joypad_polled >= POLL_INTERVAL)
     {
-        state_to_ioreg(ctx, ctx->joypad_state);
+        joypad_poll(ctx);
     }
-    
-    if (!(ctx->mem.io.JOYPAD & DIRECTION_SELECTED))
+
+    ctx->mem.io.JOYPAD = (ctx->mem.io.JOYPAD & 0xCF) |
+        (value & (CONTROL_SELECTED | DIRECTION_SELECTED));
+    update_ioreg(ctx);
+}
+
+static void schedule_input(context_t *ctx)
+{
+    const input_queue_t *queue = &ctx->input;
+
+    if (queue->next < queue->len) {
+        scheduler_schedule(&ctx->sched, EVT_INPUT,
+            queue->events[queue->next].cycle);
+    } else {
+        scheduler_cancel(&ctx->sched, EVT_INPUT);
+    }
+}
+
+/*
+ * Presses or releases <key> once ctx->cycles reaches <cycle>, instead of
+ * at whatever instruction is running when this is called. Events at the
+ * same cycle are applied in the order they were queued, ones in the past
+ * right away. Returns false if the queue could not grow.
+ */
+bool joypad_queue(context_t* ctx, uint64_t cycle, joypad_key_t key,
+    bool pressed)
+{
+    input_queue_t *queue = &ctx->input;
+
+    if (queue->len == queue->capacity && queue->next > 0) {
+        // Make room by dropping the events that were applied already.
+        memmove(queue->events, &queue->events[queue->next],
+            (queue->len - queue->next) * sizeof queue->events[0]);
+        queue->len -= queue->next;
+        queue->next = 0;
+    }
+
+    if (queue->len == queue->capacity) {
+        const size_t capacity = queue->capacity > 0 ? 2 * queue->capacity : 64;
+        input_event_t *events = realloc(queue->events,
+            capacity * sizeof events[0]);
+
+        if (events == NULL) {
+            return false;
+        }
+
+        queue->events = events;
+        queue->capacity = capacity;
+    }
+
+    // Scripts are usually queued in order, so search from the back.
+    size_t pos = queue->len;
+
+    while (pos > queue->next && queue->events[pos - 1].cycle > cycle) {
+        pos--;
+    }
+
+    memmove(&queue->events[pos + 1], &queue->events[pos],
+        (queue->len - pos) * sizeof queue->events[0]);
+    queue->events[pos] = (input_event_t){ cycle, key, pressed };
+    queue->len++;
+
+    schedule_input(ctx);
+    return true;
+}
+
+/*
+ * Like joypad_queue, at the start of the <frame>th frame since the
+ * context was created.
+ */
+bool joypad_queue_frame(context_t* ctx, uint64_t frame, joypad_key_t key,
+    bool pressed)
+{
+    return joypad_queue(ctx, frame * CYCLES_PER_FRAME, key, pressed);
+}
+
+/*
+ * Applies the queued events that are due at <time>.
+ */
+void joypad_input_event(context_t *ctx, uint64_t time)
+{
+    input_queue_t *queue = &ctx->input;
+
+    while (queue->next < queue->len &&
+        queue->events[queue->next].cycle <= time)
     {
-        state_to_ioreg(ctx, ctx->joypad_state >> 4);
+        const input_event_t *event = &queue->events[queue->next++];
+
+        if (event->pressed) {
+            joypad_press(ctx, event->key);
+        } else {
+            joypad_release(ctx, event->key);
+        }
     }
+
+    schedule_input(ctx);
 }
 
 void joypad_update_state(context_t *ctx, const SDL_KeyboardEvent *evt)
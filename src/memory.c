@@ -8,6 +8,7 @@
 
 #include "ioregs.h"
 #include "sound.h"
+#include "joypad.h"
 #include "util.h"
 #include "logging.h"
 
@@ -151,6 +152,9 @@ bool mem_load_rom(memory_t *mem, const char *filename)
 uint8_t mem_read(const context_t *ctx, uint16_t addr)
 {
     switch (addr) {
+    case R_DIV:
+    case offsetof(memory_io_t, TIMA):
+        return timers_read(ctx, addr);
     case offsetof(memory_sound_t, regs) ... offsetofend(memory_sound_t, wave_table) - 1:
         return sound_read(ctx, addr);
     default:
@@ -182,6 +186,20 @@ void mem_write(context_t *ctx, const uint16_t addr, uint8_t value)
         return;
     }
 
+    switch (addr) {
+        case range_of(memory_gfx_t, tiles):
+        case range_of(memory_gfx_t, tile_maps):
+        case range_of(memory_gfx_t, oam):
+        case offsetof(memory_io_t, LCDC):
+        case offsetof(memory_io_t, SCY) ... offsetof(memory_io_t, SCX):
+        case offsetof(memory_io_t, BGP) ... offsetof(memory_io_t, WX):
+        case R_DMA:
+            // Lines are drawn lazily, let the PPU know that
+            // they are about to change.
+            graphics_write(ctx, addr, value);
+            break;
+    }
+
     // Take care of special behaviour and
     // certain read-only registers.
     switch (addr) {
@@ -189,10 +207,13 @@ void mem_write(context_t *ctx, const uint16_t addr, uint8_t value)
             mem->io.LY = 0;
             return;
 
+        case offsetof(memory_io_t, JOYPAD):
+            joypad_write(ctx, value);
+            return;
+
         case R_DIV:
-            // Writing to the Divider Register resets it to zero,
-            // regardless of value.
-            mem->map[addr] = 0;
+        case offsetof(memory_io_t, TIMA) ... offsetof(memory_io_t, TAC):
+            timers_write(ctx, addr, value);
             return;
 
         case R_DMA:
@@ -201,7 +222,7 @@ void mem_write(context_t *ctx, const uint16_t addr, uint8_t value)
             return;
     }
     
-    if (addr >= offsetof(memory_sound_t, regs) && addr < offsetofend(memory_sound_t, regs)) {
+    if (addr >= offsetof(memory_sound_t, regs) && addr < offsetofend(memory_sound_t, wave_table)) {
         // Write to the sound hardware.
         sound_write(ctx, addr, value);
         return;
@@ -0,0 +1,68 @@
+#include "context.h"
+#include "scheduler.h"
+#include "sound.h"
+#include "timers.h"
+#include "joypad.h"
+
+static const event_handler_f handlers[EVT_COUNT] = {
+    [EVT_SEQUENCER] = sound_sequencer_event,
+    [EVT_TIMER] = timers_overflow_event,
+    [EVT_INPUT] = joypad_input_event,
+};
+
+static void update_next(scheduler_t *sched)
+{
+    sched->next = EVENT_NEVER;
+
+    for (size_t i = 0; i < EVT_COUNT; i++) {
+        if (sched->at[i] < sched->next) {
+            sched->next = sched->at[i];
+        }
+    }
+}
+
+void scheduler_init(scheduler_t *sched)
+{
+    for (size_t i = 0; i < EVT_COUNT; i++) {
+        sched->at[i] = EVENT_NEVER;
+    }
+
+    sched->next = EVENT_NEVER;
+}
+
+void scheduler_schedule(scheduler_t *sched, event_t event, uint64_t at)
+{
+    sched->at[event] = at;
+    update_next(sched);
+}
+
+void scheduler_cancel(scheduler_t *sched, event_t event)
+{
+    scheduler_schedule(sched, event, EVENT_NEVER);
+}
+
+/*
+ * Runs every event that is due at ctx->cycles, in order. Handlers may
+ * schedule their event again, it runs again if that is due, too.
+ */
+void scheduler_run(context_t *ctx)
+{
+    scheduler_t *sched = &ctx->sched;
+
+    while (scheduler_due(sched, ctx->cycles)) {
+        event_t event = 0;
+
+        for (size_t i = 1; i < EVT_COUNT; i++) {
+            if (sched->at[i] < sched->at[event]) {
+                event = i;
+            }
+        }
+
+        const uint64_t time = sched->at[event];
+
+        sched->at[event] = EVENT_NEVER;
+        update_next(sched);
+
+        handlers[event](ctx, time);
+    }
+}
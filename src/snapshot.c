@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#define COPY(dst, src, field) \
+    memcpy(&(dst)->field, &(src)->field, sizeof (dst)->field)
+
+// Fields of gfx_t that are emulated state, the rest belongs to the host.
+// Which frames are drawn is up to the host, too, see frame_skip.
+#define GFX_STATE(X) \
+    X(fifo) X(cycles) X(window_y) X(state) X(next_line) X(regs) \
+    X(writes) X(writes_len) X(writes_read) X(vram_version) \
+    X(tile_versions) X(planes) X(skip_frame) X(pooled)
+
+// Likewise for sound_t. The blips are handled separately.
+#define SOUND_STATE(X) \
+    X(square1) X(square2) X(wave) X(noise) X(sequencer) X(synced) \
+    X(frame_start)
+
+static size_t blip_size(const blip_t *blip)
+{
+    return (blip->capacity + BLIP_WIDTH) * sizeof blip->buffer[0];
+}
+
+/*
+ * Allocates a snapshot that fits the sample buffers of <ctx>. Nothing is
+ * saved yet.
+ */
+snapshot_t* snapshot_create(const context_t *ctx)
+{
+    snapshot_t *snap = calloc(1, sizeof *snap);
+
+    if (snap == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        snap->snd.buffers[i] = malloc(blip_size(&ctx->snd.blips[i]));
+
+        if (snap->snd.buffers[i] == NULL) {
+            snapshot_free(snap);
+            return NULL;
+        }
+    }
+
+    return snap;
+}
+
+void snapshot_free(snapshot_t *snap)
+{
+    if (snap != NULL) {
+        for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+            free(snap->snd.buffers[i]);
+        }
+
+        free(snap);
+    }
+}
+
+void snapshot_save(snapshot_t *snap, const context_t *ctx)
+{
+    snap->cpu = ctx->cpu;
+    snap->mem = ctx->mem;
+    snap->timers = ctx->timers;
+    snap->sched = ctx->sched;
+    snap->cycles = ctx->cycles;
+    snap->frame_cycles = ctx->frame_cycles;
+    snap->joypad_state = ctx->joypad_state;
+    snap->input_next = ctx->input.next;
+
+#define SAVE(field) COPY(&snap->gfx, &ctx->gfx, field);
+    GFX_STATE(SAVE)
+#undef SAVE
+
+#define SAVE(field) COPY(&snap->snd, &ctx->snd, field);
+    SOUND_STATE(SAVE)
+#undef SAVE
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        const blip_t *blip = &ctx->snd.blips[i];
+
+        snap->snd.blips[i] = *blip;
+        memcpy(snap->snd.buffers[i], blip->buffer, blip_size(blip));
+    }
+}
+
+/*
+ * Goes back to the saved state. The memory map points into itself and
+ * the ROM, which is why this only works for the same context.
+ */
+void snapshot_restore(const snapshot_t *snap, context_t *ctx)
+{
+    ctx->cpu = snap->cpu;
+    ctx->mem = snap->mem;
+    ctx->timers = snap->timers;
+    ctx->sched = snap->sched;
+    ctx->cycles = snap->cycles;
+    ctx->frame_cycles = snap->frame_cycles;
+    ctx->joypad_state = snap->joypad_state;
+    ctx->input.next = snap->input_next;
+
+#define RESTORE(field) COPY(&ctx->gfx, &snap->gfx, field);
+    GFX_STATE(RESTORE)
+#undef RESTORE
+
+#define RESTORE(field) COPY(&ctx->snd, &snap->snd, field);
+    SOUND_STATE(RESTORE)
+#undef RESTORE
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        blip_t *blip = &ctx->snd.blips[i];
+        int32_t *buffer = blip->buffer;
+
+        *blip = snap->snd.blips[i];
+        blip->buffer = buffer;
+        memcpy(buffer, snap->snd.buffers[i], blip_size(blip));
+    }
+}
@@ -7,36 +7,174 @@
 #include "memory.h"
 #include "ioregs.h"
 #include "sound.h"
+#include "timers.h"
+#include "scheduler.h"
+#include "sound/mixer.h"
+#include "sound/lfsr.h"
+#include "sound/capture.h"
 
 #define SAMPLE_RATE 44100
-#define BUFFER_SIZE 4096
-#define AMPLITUDE 127
 
+// Samples of every channel that are mixed at once.
+#define BUFFER_SIZE 1024
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Samples the device asks for at once, about 12 ms.
+#define DEVICE_SAMPLES 512
+
+// Bounds and default of the queued audio, see sound_set_latency.
+#define MIN_LATENCY_MS 20
+#define MAX_LATENCY_MS 250
+#define DEFAULT_LATENCY_MS 50
+
+// Channel values are 8 bit, a channel at full swing stays well within a
+// sample, see mixer_mix.
+#define VALUE_SCALE 64
+
+// The sample rate is adjusted by at most 0.5% to keep the queue at the
+// target latency, which is hardly audible.
+#define MAX_RATE_ADJUST (SAMPLE_RATE / 200)
+
+// Sample rates a capture can have. Frames of the fastest one still fit
+// into SAMPLE_CAPACITY.
+#define MIN_CAPTURE_RATE 8000
+#define MAX_CAPTURE_RATE 192000
+
+// Samples kept for a tenth of a second, more than a frame's worth.
+#define SAMPLE_CAPACITY (SAMPLE_RATE / 10)
+
+// The frame sequencer steps at 512 Hz, see sound_schedule_sequencer.
+#define SEQUENCER_CYCLES (CLOCKSPEED / 512)
+
+// Clocks of the noise channel from which on the precomputed LFSR
+// sequence is used, enough to fill the register.
+#define NOISE_MIN_RUN 16
+
+// A stereo frame, a sample for the left and for the right.
+#define FRAME_SIZE (2 * sizeof(int16_t))
+
+/*
+ * Sets up the APU, without any output.
+ */
 bool sound_init(sound_t *snd) {
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+    lfsr_init();
+
+    snd->sample_rate = SAMPLE_RATE;
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        if (!blip_init(&snd->blips[i], CLOCKSPEED, SAMPLE_RATE, SAMPLE_CAPACITY)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sound_destroy(sound_t *snd) {
+    if (snd->capture != NULL) {
+        capture_close(snd->capture);
+        snd->capture = NULL;
+    }
+
+    if (snd->device != 0) {
+        // Stops the callback before its samples go away.
+        SDL_CloseAudioDevice(snd->device);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        snd->device = 0;
+    }
+
+    if (snd->samples != NULL) {
+        rb_destroy(snd->samples);
+        snd->samples = NULL;
+    }
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        blip_destroy(&snd->blips[i]);
+    }
+}
+
+/*
+ * Runs on the audio thread. Plays whatever was queued, and silence if
+ * that is not enough.
+ */
+static void audio_callback(void *user, Uint8 *stream, int len) {
+    sound_t *snd = user;
+    const size_t wanted = len / FRAME_SIZE;
+    const size_t got = rb_read(snd->samples, stream, wanted);
+
+    if (got < wanted) {
+        // The output settles at zero anyway, see blip_read_samples.
+        memset(stream + got * FRAME_SIZE, 0, (wanted - got) * FRAME_SIZE);
+        atomic_fetch_add(&snd->underruns, 1);
+    }
+}
+
+/*
+ * Plays the samples of every frame, see sound_end_frame.
+ */
+bool sound_open_device(sound_t *snd) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
         fprintf(stderr, "SDL init failed: %s\n", SDL_GetError());
         return false;
     }
+
+    // The queue may grow to twice the latency, see output_samples.
+    snd->samples = rb_init(2 * MAX_LATENCY_MS * SAMPLE_RATE / 1000,
+        FRAME_SIZE);
+    snd->latency_ms = DEFAULT_LATENCY_MS;
+
+    if (snd->samples == NULL) {
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
     
     SDL_AudioSpec want, have;
     SDL_memset(&want, 0, sizeof(want));
     want.freq = SAMPLE_RATE;
-    want.format = AUDIO_U8;
-    want.channels = 1;
-    want.samples = BUFFER_SIZE;
-    want.callback = NULL;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = DEVICE_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = snd;
     
     snd->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
     if (snd->device == 0) {
         fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
-        SDL_Quit();
+        rb_destroy(snd->samples);
+        snd->samples = NULL;
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
         return false;
     }
 
-    SDL_PauseAudioDevice(snd->device, 0);
+    // Starts playing once enough samples are queued, see sound_end_frame.
+    snd->playing = false;
     return true;
 }
 
+/*
+ * Moves the output of a channel to <value> at <time>. Without <blip>
+ * only the value changes.
+ */
+static void set_value(uint8_t *value, uint8_t new_value, blip_t *blip, uint32_t time) {
+    if (new_value != *value) {
+        if (blip != NULL) {
+            blip_add_delta(blip, time, (new_value - *value) * VALUE_SCALE);
+        }
+
+        *value = new_value;
+    }
+}
+
+/*
+ * Turns a channel off, it is silent until the next trigger.
+ */
+static void silence(bool *enabled, uint8_t *value, blip_t *blip, uint32_t time) {
+    *enabled = false;
+    set_value(value, 0, blip, time);
+}
+
 static const uint8_t duty_table[][8] = {
     {0, 0, 0, 0, 0, 0, 0, 1}, // 12.5%
     {0, 1, 1, 1, 1, 1, 1, 0}, // 25%
@@ -44,31 +182,683 @@ static const uint8_t duty_table[][8] = {
     {1, 0, 0, 0, 0, 0, 0, 1}, // 75%
 };
 
+static uint16_t square_period(const sound_square_params_t *params) {
+    return (params->period_msb << 8) | params->period_lsb;
+}
+
+/*
+ * The channel output after <steps> more duty steps, 0 is the current one.
+ */
+static uint8_t square_value(const sound_square_state_t *ch, const sound_square_params_t *params, unsigned int steps) {
+    const uint8_t value = duty_table[params->duty][(ch->wave_step + steps + sizeof(duty_table[0]) - 1) % sizeof(duty_table[0])] * ch->volume;
+
+    // Convert to 8 bit sample. 0xff / 0xf = 0x11
+    return value * 0x11;
+}
+
+/*
+ * Advances the duty cycle by <steps> and re-arms the timer. Only the
+ * last step is audible.
+ */
+static void square_step(sound_square_state_t *ch, const sound_square_params_t *params, uint16_t period, unsigned int steps) {
+    ch->divider = period;
+    ch->value = square_value(ch, params, steps);
+
+    // TODO: Should this increment after instead?
+    ch->wave_step = (ch->wave_step + steps) % sizeof(duty_table[0]);
+}
+
+/*
+ * Runs the channel for <ticks> without output. The divider counts up
+ * from the period to 0x7ff and advances the duty cycle on the tick after
+ * that, so the number of duty steps can be computed directly.
+ */
+static void square_skip(sound_square_state_t *ch, const sound_square_params_t *params, uint16_t period, unsigned int ticks) {
+    const unsigned int until_step = 0x7ff - ch->divider + 1;
+
+    // Ticks between duty steps once the timer was re-armed.
+    const unsigned int length = 0x800 - period;
+
+    if (ticks < until_step) {
+        ch->divider += ticks;
+        return;
+    }
+
+    ticks -= until_step;
+    square_step(ch, params, period, 1 + ticks / length);
+    ch->divider += ticks % length;
+}
+
+/*
+ * Runs the channel for <ticks> ticks of 4 cycles at once, starting
+ * <time> cycles into the current frame of <blip>. Only changes of the
+ * output are visited, the steps in between are skipped. Without <blip>
+ * nothing is output at all.
+ */
+void sound_run_square(sound_square_state_t *ch, const sound_square_params_t *params, unsigned int ticks, blip_t *blip, uint32_t time) {
+    const uint16_t period = square_period(params);
+    const unsigned int length = 0x800 - period;
+
+    while (blip != NULL) {
+        unsigned int steps = 1;
+
+        while (steps <= sizeof(duty_table[0]) && square_value(ch, params, steps) == ch->value) {
+            steps++;
+        }
+
+        if (steps > sizeof(duty_table[0])) {
+            // The output never changes.
+            break;
+        }
+
+        const uint64_t until_change = (0x7ff - ch->divider + 1) + (uint64_t)(steps - 1) * length;
+
+        if (ticks < until_change) {
+            break;
+        }
+
+        const uint8_t previous = ch->value;
+
+        ticks -= until_change;
+        time += until_change * 4;
+        square_step(ch, params, period, steps);
+        blip_add_delta(blip, time, (ch->value - previous) * VALUE_SCALE);
+    }
+
+    square_skip(ch, params, period, ticks);
+}
+
 void sound_update_square(sound_square_state_t *ch, const sound_square_params_t *params) {
-    if (ch->divider < 0x7ff) {
-        ch->divider++;
+    sound_run_square(ch, params, 1, NULL, 0);
+}
+
+/*
+ * The frequency the sweep of the first channel moves to next.
+ */
+static uint16_t sweep_target(const sound_square_state_t *ch, const sound_square_params_t *params) {
+    const uint16_t delta = ch->shadow >> params->shift;
+
+    return params->negate ? ch->shadow - delta : ch->shadow + delta;
+}
+
+static void sweep_clock(sound_square_state_t *ch, sound_square_params_t *params, blip_t *blip, uint32_t time) {
+    if (ch->sweep > 1) {
+        ch->sweep--;
         return;
     }
 
-    // Re-arm the timer.
+    ch->sweep = params->sweep ? params->sweep : 8;
+
+    if (!ch->sweep_enabled || params->sweep == 0) {
+        return;
+    }
+
+    const uint16_t target = sweep_target(ch, params);
+
+    if (target > 0x7ff) {
+        silence(&ch->enabled, &ch->value, blip, time);
+        return;
+    }
+
+    if (params->shift != 0) {
+        ch->shadow = target;
+        params->period_lsb = target & 0xff;
+        params->period_msb = target >> 8;
+
+        // The next target is checked right away, too.
+        if (sweep_target(ch, params) > 0x7ff) {
+            silence(&ch->enabled, &ch->value, blip, time);
+        }
+    }
+}
+
+/*
+ * Moves <volume> one step into the direction of the envelope, returns
+ * whether it changed.
+ */
+static bool envelope_clock(uint8_t *timer, uint8_t *volume, uint8_t period, bool increase) {
+    if (period == 0) {
+        return false;
+    }
+
+    if (*timer > 1) {
+        (*timer)--;
+        return false;
+    }
+
+    *timer = period;
+
+    if (increase && *volume < 0xf) {
+        (*volume)++;
+        return true;
+    }
+
+    if (!increase && *volume > 0) {
+        (*volume)--;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Counts down the length of a channel, returns whether it ran out.
+ */
+static bool length_clock(uint16_t *length, bool enabled) {
+    return enabled && *length > 0 && --*length == 0;
+}
+
+static void square_trigger(sound_square_state_t *ch, const sound_square_params_t *params, bool sweep, blip_t *blip, uint32_t time) {
+    const uint16_t period = square_period(params);
+
+    // The DAC is off if neither volume nor envelope are set.
+    ch->enabled = params->volume != 0 || params->envelope_mode != 0;
+
+    if (ch->length == 0) {
+        ch->length = 64;
+    }
+
+    ch->divider = period;
+    ch->envelope = params->period;
+    ch->volume = params->volume;
+
+    if (sweep) {
+        ch->shadow = period;
+        ch->sweep = params->sweep ? params->sweep : 8;
+        ch->sweep_enabled = params->sweep != 0 || params->shift != 0;
+
+        if (params->shift != 0 && sweep_target(ch, params) > 0x7ff) {
+            ch->enabled = false;
+        }
+    }
+
+    set_value(&ch->value, ch->enabled ? square_value(ch, params, 0) : 0, blip, time);
+}
+
+/*
+ * The wave channel output, a nibble of the wave table shifted right by
+ * the volume code.
+ */
+static uint8_t wave_value(const sound_wave_state_t *ch, const sound_wave_params_t *params, const uint8_t *table) {
+    static const uint8_t shifts[] = { 4, 0, 1, 2 };
+    const uint8_t sample = (table[ch->position / 2] >> (ch->position % 2 ? 0 : 4)) & 0xf;
+
+    return (sample >> shifts[params->volume_code]) * 0x11;
+}
+
+/*
+ * Runs the wave channel for <ticks> ticks of 2 cycles. Like the square
+ * channels, the divider counts up from the period to 0x7ff and the
+ * position moves on the tick after that.
+ */
+static void wave_run(sound_wave_state_t *ch, const sound_wave_params_t *params, const uint8_t *table, unsigned int ticks, blip_t *blip, uint32_t time) {
+    const uint16_t period = (params->period_msb << 8) | params->period_lsb;
+    const unsigned int length = 0x800 - period;
+    unsigned int until_step = 0x800 - ch->divider;
+
+    if (params->volume_code == 0) {
+        // Muted, so the position can be computed directly.
+        if (ticks < until_step) {
+            ch->divider += ticks;
+            return;
+        }
+
+        set_value(&ch->value, 0, blip, time + until_step * 2);
+
+        ticks -= until_step;
+        ch->position = (ch->position + 1 + ticks / length) % 32;
+        ch->divider = period + ticks % length;
+        return;
+    }
+
+    while (ticks >= until_step) {
+        ticks -= until_step;
+        time += until_step * 2;
+
+        ch->position = (ch->position + 1) % 32;
+        ch->divider = period;
+        until_step = length;
+
+        set_value(&ch->value, wave_value(ch, params, table), blip, time);
+    }
+
+    ch->divider += ticks;
+}
+
+static void wave_trigger(sound_wave_state_t *ch, const sound_wave_params_t *params) {
+    ch->enabled = params->dac_on;
+
+    if (ch->length == 0) {
+        ch->length = 256;
+    }
+
+    // The first sample is only played after the first step.
     ch->divider = (params->period_msb << 8) | params->period_lsb;
+    ch->position = 0;
+}
 
-    // TODO: Length, envelope.
-    ch->value = duty_table[params->duty][ch->wave_step] * ch->volume;
+/*
+ * Cycles between clocks of the LFSR.
+ */
+static uint32_t noise_period(const sound_noise_params_t *params) {
+    static const uint8_t divisors[] = { 8, 16, 32, 48, 64, 80, 96, 112 };
 
-    // Convert to 8 bit sample. 0xff / 0xf = 0x11
-    ch->value *= 0x11;
+    return divisors[params->divisor_code] << params->clock_shift;
+}
+
+static uint8_t noise_output(bool bit, uint8_t volume) {
+    return bit ? 0 : volume * 0x11;
+}
 
-    // Advance duty cycle. TODO: Should this increment after instead?
-    ch->wave_step = (ch->wave_step + 1) % sizeof(duty_table[0]);
+static uint8_t noise_value(const sound_noise_state_t *ch) {
+    return noise_output(ch->lfsr & 1, ch->volume);
 }
 
-void sound_update(context_t *ctx, unsigned int cycles) {
-    assert(cycles % 4 == 0);
+/*
+ * Runs the noise channel for <cycles>, clocking the LFSR whenever its
+ * divider runs out. Longer runs look up the changes of the output in
+ * the precomputed sequence, instead of clocking the register each time.
+ */
+void sound_run_noise(sound_noise_state_t *ch, const sound_noise_params_t *params, uint32_t cycles, blip_t *blip, uint32_t time) {
+    if (params->clock_shift >= 14) {
+        // The LFSR doesn't get any clocks.
+        return;
+    }
+
+    if (cycles < ch->divider) {
+        ch->divider -= cycles;
+        return;
+    }
+
+    const uint32_t period = noise_period(params);
+    const uint32_t clocks = 1 + (cycles - ch->divider) / period;
+    const lfsr_table_t *table = lfsr_table(params->lfsr_width);
+    const uint16_t state = ch->lfsr & table->period;
+
+    // Time of the first clock.
+    time += ch->divider;
+    ch->divider = period - (cycles - ch->divider) % period;
+
+    if (clocks < NOISE_MIN_RUN || state == 0) {
+        // Short, or stuck at zero, where the output never changes and
+        // the register is empty after 15 clocks.
+        for (uint32_t i = 0; i < MIN(clocks, NOISE_MIN_RUN); i++) {
+            ch->lfsr = lfsr_clock(ch->lfsr, params->lfsr_width);
+            set_value(&ch->value, noise_value(ch), blip, time + i * period);
+        }
+        return;
+    }
+
+    const unsigned int start = table->positions[state];
+    unsigned int position = start;
+    uint32_t done = 0;
+
+    while (blip != NULL) {
+        const unsigned int distance = lfsr_distance(table, position);
+
+        if (done + distance > clocks) {
+            break;
+        }
+
+        done += distance;
+        position = (position + distance) % table->period;
 
-    for (; cycles > 0; cycles -= 4) {
-        sound_update_square(&ctx->snd.square1, &ctx->mem.sound.square1);
+        set_value(&ch->value, noise_output(lfsr_bit(table, position), ch->volume), blip, time + (done - 1) * period);
     }
+
+    // Without <blip> the changes weren't looked up at all.
+    ch->lfsr = lfsr_register(table, (start + clocks) % table->period);
+    ch->value = noise_value(ch);
+}
+
+static void noise_trigger(sound_noise_state_t *ch, const sound_noise_params_t *params, blip_t *blip, uint32_t time) {
+    ch->enabled = params->volume != 0 || params->envelope_mode != 0;
+
+    if (ch->length == 0) {
+        ch->length = 64;
+    }
+
+    ch->divider = noise_period(params);
+    ch->lfsr = 0x7fff;
+    ch->envelope = params->period;
+    ch->volume = params->volume;
+
+    set_value(&ch->value, ch->enabled ? noise_value(ch) : 0, blip, time);
+}
+
+/*
+ * Runs every enabled channel for <cycles>, starting at snd->synced.
+ */
+static void run_channels(context_t *ctx, uint32_t cycles) {
+    sound_t *snd = &ctx->snd;
+    const memory_sound_t *regs = &ctx->mem.sound;
+    const uint32_t time = snd->synced - snd->frame_start;
+
+    if (snd->square1.enabled) {
+        sound_run_square(&snd->square1, &regs->square1, cycles / 4, &snd->blips[0], time);
+    }
+
+    if (snd->square2.enabled) {
+        sound_run_square(&snd->square2, &regs->square2, cycles / 4, &snd->blips[1], time);
+    }
+
+    if (snd->wave.enabled) {
+        wave_run(&snd->wave, &regs->wave, regs->wave_table, cycles / 2, &snd->blips[2], time);
+    }
+
+    if (snd->noise.enabled) {
+        sound_run_noise(&snd->noise, &regs->noise, cycles, &snd->blips[3], time);
+    }
+}
+
+/*
+ * Steps the frame sequencer at snd->synced: lengths on every other
+ * step, the sweep on steps 2 and 6 and envelopes on step 7.
+ */
+static void clock_sequencer(context_t *ctx) {
+    sound_t *snd = &ctx->snd;
+    memory_sound_t *regs = &ctx->mem.sound;
+    const uint32_t time = snd->synced - snd->frame_start;
+    const uint8_t step = snd->sequencer;
+
+    snd->sequencer = (step + 1) % 8;
+
+    if (step % 2 == 0) {
+        if (length_clock(&snd->square1.length, regs->square1.length_enable)) {
+            silence(&snd->square1.enabled, &snd->square1.value, &snd->blips[0], time);
+        }
+
+        if (length_clock(&snd->square2.length, regs->square2.length_enable)) {
+            silence(&snd->square2.enabled, &snd->square2.value, &snd->blips[1], time);
+        }
+
+        if (length_clock(&snd->wave.length, regs->wave.length_enable)) {
+            silence(&snd->wave.enabled, &snd->wave.value, &snd->blips[2], time);
+        }
+
+        if (length_clock(&snd->noise.length, regs->noise.length_enable)) {
+            silence(&snd->noise.enabled, &snd->noise.value, &snd->blips[3], time);
+        }
+    }
+
+    if ((step == 2 || step == 6) && snd->square1.enabled) {
+        sweep_clock(&snd->square1, &regs->square1, &snd->blips[0], time);
+    }
+
+    if (step == 7) {
+        if (snd->square1.enabled && envelope_clock(&snd->square1.envelope, &snd->square1.volume, regs->square1.period, regs->square1.envelope_mode)) {
+            set_value(&snd->square1.value, square_value(&snd->square1, &regs->square1, 0), &snd->blips[0], time);
+        }
+
+        if (snd->square2.enabled && envelope_clock(&snd->square2.envelope, &snd->square2.volume, regs->square2.period, regs->square2.envelope_mode)) {
+            set_value(&snd->square2.value, square_value(&snd->square2, &regs->square2, 0), &snd->blips[1], time);
+        }
+
+        if (snd->noise.enabled && envelope_clock(&snd->noise.envelope, &snd->noise.volume, regs->noise.period, regs->noise.envelope_mode)) {
+            set_value(&snd->noise.value, noise_value(&snd->noise), &snd->blips[3], time);
+        }
+    }
+}
+
+/*
+ * Mirrors which channels are playing into NR52.
+ */
+static void update_status(context_t *ctx) {
+    const sound_t *snd = &ctx->snd;
+
+    ctx->mem.sound.channel_statuses = snd->square1.enabled |
+        snd->square2.enabled << 1 | snd->wave.enabled << 2 | snd->noise.enabled << 3;
+}
+
+/*
+ * Runs the channels up to <until>. Registers don't change while
+ * catching up, so everything since the last sync is handled in one go.
+ */
+static void sync_to(context_t *ctx, uint64_t until) {
+    sound_t *snd = &ctx->snd;
+
+    if (until < snd->synced + 4) {
+        return;
+    }
+
+    const uint64_t end = snd->synced + (until - snd->synced) / 4 * 4;
+
+    run_channels(ctx, end - snd->synced);
+    snd->synced = end;
+}
+
+/*
+ * Runs the channels up to ctx->cycles. Called before sound registers
+ * change and at the end of every frame, the channels are not touched
+ * in between.
+ */
+void sound_sync(context_t *ctx) {
+    sync_to(ctx, ctx->cycles);
+    update_status(ctx);
+}
+
+/*
+ * Schedules the next step of the frame sequencer. It follows the
+ * divider, and steps whenever bit 12 of it falls.
+ */
+void sound_schedule_sequencer(context_t *ctx) {
+    const uint16_t divider = timers_divider(ctx);
+
+    scheduler_schedule(&ctx->sched, EVT_SEQUENCER,
+        ctx->cycles + SEQUENCER_CYCLES - divider % SEQUENCER_CYCLES);
+}
+
+/*
+ * Steps the frame sequencer at <time>, and schedules the next step.
+ */
+void sound_sequencer_event(context_t *ctx, uint64_t time) {
+    sync_to(ctx, time);
+
+    if (ctx->mem.sound.power) {
+        clock_sequencer(ctx);
+    }
+
+    update_status(ctx);
+    scheduler_schedule(&ctx->sched, EVT_SEQUENCER, time + SEQUENCER_CYCLES);
+}
+
+/*
+ * Called when DIV is written, with whether bit 12 of the divider was
+ * set before.
+ */
+void sound_divider_reset(context_t *ctx, bool step) {
+    if (step) {
+        sound_sequencer_event(ctx, ctx->cycles);
+    } else {
+        sound_schedule_sequencer(ctx);
+    }
+}
+
+/*
+ * Mixes the samples up to snd->synced, and plays or captures them.
+ */
+static void output_samples(context_t *ctx) {
+    sound_t *snd = &ctx->snd;
+    const memory_sound_t *regs = &ctx->mem.sound;
+    int16_t channels[SOUND_CHANNELS][BUFFER_SIZE];
+    int16_t samples[2 * BUFFER_SIZE];
+    size_t len;
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        blip_end_frame(&snd->blips[i], snd->synced - snd->frame_start);
+    }
+
+    snd->frame_start = snd->synced;
+
+    if (snd->muted || (snd->device == 0 && snd->capture == NULL)) {
+        // Nobody listens.
+        for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+            blip_discard(&snd->blips[i], blip_samples_avail(&snd->blips[i]));
+        }
+        return;
+    }
+
+    // Volume and panning are taken as they are at the end of the frame.
+    int16_t left[SOUND_CHANNELS], right[SOUND_CHANNELS];
+    const int16_t *inputs[SOUND_CHANNELS];
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        left[i] = BIT_ISSET(regs->left_enables, i) ? regs->volume_left + 1 : 0;
+        right[i] = BIT_ISSET(regs->right_enables, i) ? regs->volume_right + 1 : 0;
+        inputs[i] = channels[i];
+    }
+
+    // The queue is kept around the target, see below. Samples that would
+    // make the audio lag behind more than twice that are dropped.
+    const size_t target = snd->latency_ms * SAMPLE_RATE / 1000;
+    bool dropped = false;
+
+    // All channels end their frames at the same time, so they always
+    // have the same number of samples.
+    while ((len = MIN(blip_samples_avail(&snd->blips[0]), BUFFER_SIZE)) > 0) {
+        for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+            blip_read_samples(&snd->blips[i], channels[i], len);
+        }
+
+        mixer_mix(samples, inputs, left, right, len);
+
+        if (snd->capture != NULL) {
+            capture_push(snd->capture, samples, len);
+            continue;
+        }
+
+        const size_t queued = rb_used(snd->samples);
+        const size_t room = queued < 2 * target ? 2 * target - queued : 0;
+
+        dropped |= rb_write(snd->samples, samples, MIN(len, room)) < len;
+    }
+
+    if (snd->device == 0) {
+        return;
+    }
+
+    if (dropped) {
+        snd->overruns++;
+    }
+
+    // The device only plays once the queue is filled up to the target,
+    // and again after it ran dry, e.g. while execution was stopped.
+    const uint64_t underruns = atomic_load(&snd->underruns);
+    const size_t queued = rb_used(snd->samples);
+
+    if (!snd->playing && queued >= target) {
+        SDL_PauseAudioDevice(snd->device, 0);
+        snd->playing = true;
+        snd->fill = queued;
+    } else if (snd->playing && underruns != snd->seen_underruns && queued < target / 4) {
+        SDL_PauseAudioDevice(snd->device, 1);
+        snd->playing = false;
+    }
+
+    snd->seen_underruns = underruns;
+
+    // Emulation is paced by a different clock than the device's, see
+    // context_run. Instead of letting the queue grow or run dry, the
+    // channels are resampled a little faster or slower.
+    if (!snd->playing) {
+        return;
+    }
+
+    snd->fill = (snd->fill * 7 + queued) / 8;
+
+    const long error = MAX((long)target - (long)snd->fill, -(long)target);
+    const unsigned int rate = SAMPLE_RATE + MAX_RATE_ADJUST * error / (long)target;
+
+    if (rate != snd->sample_rate) {
+        for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+            blip_set_rates(&snd->blips[i], CLOCKSPEED, rate);
+        }
+
+        snd->sample_rate = rate;
+    }
+}
+
+/*
+ * Makes the samples up to ctx->cycles available, and plays or captures
+ * them. Called at the end of every frame.
+ */
+void sound_end_frame(context_t *ctx) {
+    sound_sync(ctx);
+    output_samples(ctx);
+}
+
+/*
+ * Resamples to <rate> from now on.
+ */
+static void set_sample_rate(context_t *ctx, unsigned int rate) {
+    sound_t *snd = &ctx->snd;
+
+    // The rate applies to whole frames of the buffers, so the current
+    // one is ended early.
+    sound_sync(ctx);
+    output_samples(ctx);
+
+    for (size_t i = 0; i < SOUND_CHANNELS; i++) {
+        blip_set_rates(&snd->blips[i], CLOCKSPEED, rate);
+    }
+
+    snd->sample_rate = rate;
+}
+
+/*
+ * Writes the output to <filename> at <sample_rate> from now on, see
+ * capture_open. Only works without an audio device, e.g. for headless
+ * contexts. Runs that capture the same output get the same samples.
+ */
+bool sound_start_capture(context_t *ctx, const char *filename, capture_format_t format, unsigned int sample_rate) {
+    sound_t *snd = &ctx->snd;
+
+    sound_stop_capture(ctx);
+
+    if (snd->device != 0 || sample_rate < MIN_CAPTURE_RATE || sample_rate > MAX_CAPTURE_RATE) {
+        return false;
+    }
+
+    // Samples before the capture are still discarded.
+    set_sample_rate(ctx, sample_rate);
+    snd->capture = capture_open(filename, format, sample_rate);
+
+    return snd->capture != NULL;
+}
+
+/*
+ * Writes the samples up to now and finishes the capture. Returns false
+ * if anything could not be written.
+ */
+bool sound_stop_capture(context_t *ctx) {
+    sound_t *snd = &ctx->snd;
+    bool ok = true;
+
+    if (snd->capture != NULL) {
+        set_sample_rate(ctx, SAMPLE_RATE);
+        ok = capture_close(snd->capture);
+        snd->capture = NULL;
+    }
+
+    return ok;
+}
+
+/*
+ * Queues at most <ms> milliseconds of audio, between MIN_LATENCY_MS and
+ * MAX_LATENCY_MS. Less is more responsive, more survives slow frames.
+ */
+void sound_set_latency(context_t *ctx, unsigned int ms) {
+    ctx->snd.latency_ms = MIN(MAX(ms, MIN_LATENCY_MS), MAX_LATENCY_MS);
+}
+
+void sound_get_stats(const context_t *ctx, audio_stats_t *stats) {
+    const sound_t *snd = &ctx->snd;
+
+    stats->underruns = atomic_load(&snd->underruns);
+    stats->overruns = snd->overruns;
+    stats->latency_ms = snd->samples == NULL ? 0 :
+        rb_used(snd->samples) * 1000 / SAMPLE_RATE;
+    stats->sample_rate = snd->sample_rate;
 }
 
 uint8_t sound_read(const context_t *ctx, uint16_t addr)
@@ -97,22 +887,110 @@ uint8_t sound_read(const context_t *ctx, uint16_t addr)
     }
 }
 
+/*
+ * Applies a write to the registers of a channel, after the value was
+ * stored.
+ */
+static void write_channel(context_t *ctx, uint16_t addr, uint8_t value) {
+    sound_t *snd = &ctx->snd;
+    const memory_sound_t *regs = &ctx->mem.sound;
+    const uint32_t time = snd->synced - snd->frame_start;
+
+    switch (addr) {
+    case offsetof(memory_sound_t, NR11):
+        snd->square1.length = 64 - regs->square1.length_load;
+        break;
+    case offsetof(memory_sound_t, NR21):
+        snd->square2.length = 64 - regs->square2.length_load;
+        break;
+    case offsetof(memory_sound_t, NR31):
+        snd->wave.length = 256 - value;
+        break;
+    case offsetof(memory_sound_t, NR41):
+        snd->noise.length = 64 - regs->noise.length_load;
+        break;
+
+    // Turning off the DAC of a channel turns off the channel.
+    case offsetof(memory_sound_t, NR12):
+        if ((value & 0xf8) == 0) {
+            silence(&snd->square1.enabled, &snd->square1.value, &snd->blips[0], time);
+        }
+        break;
+    case offsetof(memory_sound_t, NR22):
+        if ((value & 0xf8) == 0) {
+            silence(&snd->square2.enabled, &snd->square2.value, &snd->blips[1], time);
+        }
+        break;
+    case offsetof(memory_sound_t, NR30):
+        if (!regs->wave.dac_on) {
+            silence(&snd->wave.enabled, &snd->wave.value, &snd->blips[2], time);
+        }
+        break;
+    case offsetof(memory_sound_t, NR42):
+        if ((value & 0xf8) == 0) {
+            silence(&snd->noise.enabled, &snd->noise.value, &snd->blips[3], time);
+        }
+        break;
+
+    case offsetof(memory_sound_t, NR14):
+        if (regs->square1.trigger) {
+            square_trigger(&snd->square1, &regs->square1, true, &snd->blips[0], time);
+        }
+        break;
+    case offsetof(memory_sound_t, NR24):
+        if (regs->square2.trigger) {
+            square_trigger(&snd->square2, &regs->square2, false, &snd->blips[1], time);
+        }
+        break;
+    case offsetof(memory_sound_t, NR34):
+        if (regs->wave.trigger) {
+            wave_trigger(&snd->wave, &regs->wave);
+        }
+        break;
+    case offsetof(memory_sound_t, NR44):
+        if (regs->noise.trigger) {
+            noise_trigger(&snd->noise, &regs->noise, &snd->blips[3], time);
+        }
+        break;
+    }
+}
+
 void sound_write(context_t *ctx, uint16_t addr, uint8_t value)
 {
+    sound_t *snd = &ctx->snd;
+
+    // Everything up to now is synthesised with the old values.
+    sound_sync(ctx);
+
+    const uint32_t time = snd->synced - snd->frame_start;
+
     switch (addr) {
     case offsetof(memory_sound_t, NR52):
         if (BIT_ISSET(value, 7)) {
-            // Reset frame sequencer
-            // Reset square duty units
-            // Reset wave channel buffer
+            if (!ctx->mem.sound.power) {
+                snd->sequencer = 0;
+                snd->square1.wave_step = 0;
+                snd->square2.wave_step = 0;
+            }
+
             ctx->mem.sound.power = 1;
         } else {
             memset(ctx->mem.sound.regs, 0, sizeof(ctx->mem.sound.regs));
+
+            silence(&snd->square1.enabled, &snd->square1.value, &snd->blips[0], time);
+            silence(&snd->square2.enabled, &snd->square2.value, &snd->blips[1], time);
+            silence(&snd->wave.enabled, &snd->wave.value, &snd->blips[2], time);
+            silence(&snd->noise.enabled, &snd->noise.value, &snd->blips[3], time);
         }
         break;
         
     case range_of(memory_sound_t, unused):
         return;
+
+    case range_of(memory_sound_t, wave_table):
+        // Wave RAM is not part of the APU's power.
+        ctx->mem.map[addr] = value;
+        return;
         
     default:
         if (!ctx->mem.sound.power) {
@@ -121,7 +999,9 @@ void sound_write(context_t *ctx, uint16_t addr, uint8_t value)
             return;
         }
         
-        // TODO: Wildly inaccurate.
         ctx->mem.map[addr] = value;
+        write_channel(ctx, addr, value);
     }
+
+    update_status(ctx);
 }
@@ -0,0 +1,196 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sound/blip.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define PI (3.14159265358979323846)
+
+// Fractional bits of sample positions, resp. of the kernel.
+#define FRAC_BITS (32)
+#define KERNEL_BITS (12)
+#define PHASE_SHIFT (FRAC_BITS - BLIP_PHASE_BITS)
+
+// Bandwidth of a step, relative to the Nyquist frequency of the output.
+#define CUTOFF (0.9)
+
+// The output slowly returns to zero, like behind the capacitor of the
+// real hardware. Removes DC within about 512 samples.
+#define HIGH_PASS_SHIFT (9)
+
+/*
+ * Windowed sinc impulses, for steps at every sub-sample position. The
+ * buffer is integrated when it is read, so an impulse turns into a
+ * band-limited step.
+ */
+static void make_kernel(blip_t* blip)
+{
+    for (size_t phase = 0; phase < BLIP_PHASES; phase++) {
+        const double frac = (double)phase / BLIP_PHASES;
+        double taps[BLIP_WIDTH];
+        double sum = 0;
+        int total = 0;
+
+        for (size_t i = 0; i < BLIP_WIDTH; i++) {
+            const double x = (double)i - (BLIP_WIDTH / 2 - 1) - frac;
+            const double window = 0.42 + 0.5 * cos(2 * PI * x / BLIP_WIDTH) +
+                0.08 * cos(4 * PI * x / BLIP_WIDTH);
+            const double sinc = x == 0 ? 1 :
+                sin(PI * CUTOFF * x) / (PI * CUTOFF * x);
+
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        for (size_t i = 0; i < BLIP_WIDTH; i++) {
+            blip->kernel[phase][i] = lround(taps[i] / sum * (1 << KERNEL_BITS));
+            total += blip->kernel[phase][i];
+        }
+
+        // Rounding errors go to the center, every step has to end up
+        // at exactly the same height.
+        blip->kernel[phase][BLIP_WIDTH / 2 - 1 + (2 * phase >= BLIP_PHASES)] +=
+            (1 << KERNEL_BITS) - total;
+    }
+}
+
+/*
+ * Sets up a buffer for <capacity> samples at <sample_rate>, from deltas
+ * timed in cycles of <clock_rate>. A frame can't be longer than that.
+ */
+bool blip_init(blip_t* blip, unsigned int clock_rate,
+    unsigned int sample_rate, size_t capacity)
+{
+    memset(blip, 0, sizeof *blip);
+
+    blip->buffer = calloc(capacity + BLIP_WIDTH, sizeof blip->buffer[0]);
+
+    if (blip->buffer == NULL) {
+        return false;
+    }
+
+    blip_set_rates(blip, clock_rate, sample_rate);
+    blip->capacity = capacity;
+    make_kernel(blip);
+
+    return true;
+}
+
+/*
+ * Changes the rates, e.g. to resample slightly faster or slower. Takes
+ * effect from the start of the current frame.
+ */
+void blip_set_rates(blip_t* blip, unsigned int clock_rate,
+    unsigned int sample_rate)
+{
+    blip->factor = ((uint64_t)sample_rate << FRAC_BITS) / clock_rate;
+}
+
+void blip_destroy(blip_t* blip)
+{
+    free(blip->buffer);
+    blip->buffer = NULL;
+}
+
+/*
+ * Throws away all samples and silences the output.
+ */
+void blip_clear(blip_t* blip)
+{
+    memset(blip->buffer, 0,
+        (blip->capacity + BLIP_WIDTH) * sizeof blip->buffer[0]);
+    blip->offset = 0;
+    blip->integrator = 0;
+}
+
+/*
+ * Changes the output by <delta> at <time> cycles into the current
+ * frame.
+ */
+void blip_add_delta(blip_t* blip, uint32_t time, int delta)
+{
+    const uint64_t pos = blip->offset + time * blip->factor;
+    const int16_t* kernel =
+        blip->kernel[(pos >> PHASE_SHIFT) & (BLIP_PHASES - 1)];
+    int32_t* out = blip->buffer + (pos >> FRAC_BITS);
+
+    assert((pos >> FRAC_BITS) < blip->capacity);
+
+    for (size_t i = 0; i < BLIP_WIDTH; i++) {
+        out[i] += kernel[i] * delta;
+    }
+}
+
+/*
+ * Ends the current frame after <time> cycles. Its samples can be read
+ * now, and the next frame starts right after it.
+ */
+void blip_end_frame(blip_t* blip, uint32_t time)
+{
+    blip->offset += time * blip->factor;
+
+    assert(blip_samples_avail(blip) <= blip->capacity);
+}
+
+size_t blip_samples_avail(const blip_t* blip)
+{
+    return blip->offset >> FRAC_BITS;
+}
+
+static void remove_samples(blip_t* blip, size_t count)
+{
+    const size_t remaining = blip_samples_avail(blip) - count + BLIP_WIDTH;
+
+    memmove(blip->buffer, blip->buffer + count,
+        remaining * sizeof blip->buffer[0]);
+    memset(blip->buffer + remaining, 0, count * sizeof blip->buffer[0]);
+
+    blip->offset -= (uint64_t)count << FRAC_BITS;
+}
+
+/*
+ * Reads up to <count> samples into <out>, returns how many there were.
+ */
+size_t blip_read_samples(blip_t* blip, int16_t* out, size_t count)
+{
+    int32_t sum = blip->integrator;
+
+    count = MIN(count, blip_samples_avail(blip));
+
+    for (size_t i = 0; i < count; i++) {
+        sum += blip->buffer[i];
+
+        const int32_t sample = sum >> KERNEL_BITS;
+
+        out[i] = sample > INT16_MAX ? INT16_MAX :
+            sample < INT16_MIN ? INT16_MIN : sample;
+
+        sum -= sum >> HIGH_PASS_SHIFT;
+    }
+
+    blip->integrator = sum;
+    remove_samples(blip, count);
+
+    return count;
+}
+
+/*
+ * Like blip_read_samples, without keeping the samples.
+ */
+void blip_discard(blip_t* blip, size_t count)
+{
+    int32_t sum = blip->integrator;
+
+    count = MIN(count, blip_samples_avail(blip));
+
+    for (size_t i = 0; i < count; i++) {
+        sum += blip->buffer[i];
+        sum -= sum >> HIGH_PASS_SHIFT;
+    }
+
+    blip->integrator = sum;
+    remove_samples(blip, count);
+}
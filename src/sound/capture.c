@@ -0,0 +1,184 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sound/capture.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Queued items are the number of frames followed by the samples.
+#define ITEM_SIZE (sizeof(uint32_t) + CAPTURE_BLOCK * 2 * sizeof(int16_t))
+
+// Blocks that may be waiting for the disk, about 1.5 seconds worth.
+#define CAPTURE_QUEUE (64)
+
+#define WAV_HEADER_SIZE (44)
+
+// Sizes of streams that are still being written.
+#define WAV_UNKNOWN_SIZE (0xFFFFFFFF)
+
+static uint8_t* put16(uint8_t* dst, uint16_t value)
+{
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+    return dst + 2;
+}
+
+static uint8_t* put32(uint8_t* dst, uint32_t value)
+{
+    dst = put16(dst, value & 0xFFFF);
+    return put16(dst, value >> 16);
+}
+
+/*
+ * A canonical 44 byte header for 16 bit stereo PCM, <data_size> bytes of
+ * it.
+ */
+static void wav_header(uint8_t* dst, unsigned int sample_rate,
+    uint32_t data_size)
+{
+    const uint32_t riff_size = data_size == WAV_UNKNOWN_SIZE ?
+        WAV_UNKNOWN_SIZE : WAV_HEADER_SIZE - 8 + data_size;
+
+    memcpy(dst, "RIFF", 4);
+    dst = put32(dst + 4, riff_size);
+    memcpy(dst, "WAVEfmt ", 8);
+    dst = put32(dst + 8, 16);
+    dst = put16(dst, 1);                    // PCM
+    dst = put16(dst, 2);                    // Channels
+    dst = put32(dst, sample_rate);
+    dst = put32(dst, sample_rate * 4);      // Bytes per second
+    dst = put16(dst, 4);                    // Bytes per frame
+    dst = put16(dst, 16);                   // Bits per sample
+    memcpy(dst, "data", 4);
+    put32(dst + 4, data_size);
+}
+
+/*
+ * Little endian samples, as both formats want them.
+ */
+static size_t encode_pcm(void* user, const uint8_t* item, uint8_t* dst)
+{
+    uint32_t frames;
+    const uint8_t* samples = item + sizeof frames;
+
+    (void)user;
+    memcpy(&frames, item, sizeof frames);
+
+    for (size_t i = 0; i < 2 * frames; i++) {
+        int16_t sample;
+
+        memcpy(&sample, samples + i * sizeof sample, sizeof sample);
+        dst = put16(dst, sample);
+    }
+
+    return frames * 2 * sizeof(int16_t);
+}
+
+/*
+ * Starts writing 16 bit stereo samples at <sample_rate> to <filename>.
+ */
+capture_t* capture_open(const char* filename, capture_format_t format,
+    unsigned int sample_rate)
+{
+    uint8_t header[WAV_HEADER_SIZE];
+    size_t header_len = 0;
+
+    capture_t* capture = malloc(sizeof *capture);
+
+    if (capture == NULL) {
+        return NULL;
+    }
+
+    memset(capture, 0, sizeof *capture);
+
+    switch (format) {
+    case CAPTURE_WAV:
+        wav_header(header, sample_rate, WAV_UNKNOWN_SIZE);
+        header_len = sizeof header;
+        break;
+
+    case CAPTURE_PCM:
+        break;
+
+    default:
+        goto error;
+    }
+
+    capture->filename = strdup(filename);
+
+    if (capture->filename == NULL) {
+        goto error;
+    }
+
+    capture->writer = writer_open(filename, header, header_len, ITEM_SIZE,
+        CAPTURE_QUEUE, encode_pcm, ITEM_SIZE - sizeof(uint32_t), capture);
+
+    if (capture->writer == NULL) {
+        goto error;
+    }
+
+    capture->format = format;
+    capture->sample_rate = sample_rate;
+
+    return capture;
+
+    error: {
+        free(capture->filename);
+        free(capture);
+        return NULL;
+    }
+}
+
+/*
+ * Queues <frames> interleaved stereo frames. Waits if the writer fell
+ * behind.
+ */
+void capture_push(capture_t* capture, const int16_t* samples, size_t frames)
+{
+    while (frames > 0) {
+        const uint32_t len = MIN(frames, CAPTURE_BLOCK);
+        uint8_t* item = writer_reserve_wait(capture->writer);
+
+        memcpy(item, &len, sizeof len);
+        memcpy(item + sizeof len, samples, len * 2 * sizeof(int16_t));
+        writer_commit(capture->writer);
+
+        capture->frames += len;
+        samples += 2 * len;
+        frames -= len;
+    }
+}
+
+/*
+ * Writes all queued samples and, for WAV, the final sizes. Returns false
+ * if anything could not be written.
+ */
+bool capture_close(capture_t* capture)
+{
+    bool ok = writer_close(capture->writer);
+
+    if (ok && capture->format == CAPTURE_WAV) {
+        const uint64_t data_size = capture->frames * 2 * sizeof(int16_t);
+        uint8_t header[WAV_HEADER_SIZE];
+        const int fd = open(capture->filename, O_WRONLY);
+
+        // Longer streams keep the unknown sizes.
+        wav_header(header, capture->sample_rate,
+            data_size < WAV_UNKNOWN_SIZE - WAV_HEADER_SIZE ?
+                data_size : WAV_UNKNOWN_SIZE);
+
+        if (fd < 0) {
+            ok = false;
+        } else {
+            ok = pwrite(fd, header, sizeof header, 0) == sizeof header;
+            ok = close(fd) == 0 && ok;
+        }
+    }
+
+    free(capture->filename);
+    free(capture);
+
+    return ok;
+}
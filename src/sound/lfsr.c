@@ -0,0 +1,118 @@
+#include <stddef.h>
+#include <SDL2/SDL.h>
+
+#include "sound/lfsr.h"
+
+#define WORDS(bits) (((bits) + 63) / 64)
+
+static uint16_t wide_values[LFSR_PERIOD_WIDE];
+static uint16_t wide_positions[LFSR_PERIOD_WIDE + 1];
+static uint64_t wide_bits[WORDS(2 * LFSR_PERIOD_WIDE)];
+
+static uint16_t narrow_values[LFSR_PERIOD_NARROW];
+static uint16_t narrow_positions[LFSR_PERIOD_NARROW + 1];
+static uint64_t narrow_bits[WORDS(2 * LFSR_PERIOD_NARROW)];
+
+static const lfsr_table_t tables[] = {
+    { LFSR_PERIOD_WIDE, wide_values, wide_positions, wide_bits },
+    { LFSR_PERIOD_NARROW, narrow_values, narrow_positions, narrow_bits },
+};
+
+// Contexts might be created on several threads at once.
+static SDL_SpinLock lock = 0;
+static bool initialized = false;
+
+/*
+ * Clocks the register once. In 7 bit mode, the new bit goes into bit 6,
+ * too, so that the lower 7 bits form a shorter LFSR of their own.
+ */
+uint16_t lfsr_clock(uint16_t lfsr, bool narrow)
+{
+    const uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+
+    lfsr = (lfsr >> 1) | (bit << 14);
+
+    if (narrow) {
+        lfsr = (lfsr & ~(1 << 6)) | (bit << 6);
+    }
+
+    return lfsr;
+}
+
+static void fill(const lfsr_table_t* table, bool narrow)
+{
+    uint16_t* values = (uint16_t*)table->values;
+    uint16_t* positions = (uint16_t*)table->positions;
+    uint64_t* bits = (uint64_t*)table->bits;
+    uint16_t lfsr = table->period;
+
+    for (unsigned int i = 0; i < table->period; i++) {
+        values[i] = lfsr;
+        positions[lfsr] = i;
+
+        if (lfsr & 1) {
+            bits[i / 64] |= 1ull << (i % 64);
+            bits[(i + table->period) / 64] |= 1ull << ((i + table->period) % 64);
+        }
+
+        lfsr = lfsr_clock(lfsr, narrow) & table->period;
+    }
+}
+
+/*
+ * Computes both sequences, once. Safe to call from several threads.
+ */
+void lfsr_init(void)
+{
+    SDL_AtomicLock(&lock);
+
+    if (!initialized) {
+        fill(&tables[0], false);
+        fill(&tables[1], true);
+        initialized = true;
+    }
+
+    SDL_AtomicUnlock(&lock);
+}
+
+const lfsr_table_t* lfsr_table(bool narrow)
+{
+    return &tables[narrow];
+}
+
+/*
+ * Clocks from <position> until bit 0 changes. Each period has ones and
+ * zeros, so the search ends within a period.
+ */
+unsigned int lfsr_distance(const lfsr_table_t* table, unsigned int position)
+{
+    const uint64_t flip = lfsr_bit(table, position) ? ~0ull : 0;
+    unsigned int i = position + 1;
+
+    while (true) {
+        const uint64_t word = (table->bits[i / 64] ^ flip) >> (i % 64);
+
+        if (word != 0) {
+            return i + __builtin_ctzll(word) - position;
+        }
+
+        i += 64 - i % 64;
+    }
+}
+
+/*
+ * The full 15 bit register at <position>, if the last 8 clocks or more
+ * were in the width of <table>. In 7 bit mode, bits 14 to 7 hold the
+ * last 8 new bits, 7 of which are the lower bits again.
+ */
+uint16_t lfsr_register(const lfsr_table_t* table, unsigned int position)
+{
+    if (table->period == LFSR_PERIOD_WIDE) {
+        return table->values[position];
+    }
+
+    const uint16_t value = table->values[position];
+    const uint16_t previous = table->values[(position + table->period - 1) % table->period];
+
+    return (value << 8) | ((previous & 1) << 7) | value;
+}
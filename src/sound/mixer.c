@@ -0,0 +1,79 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "sound/mixer.h"
+
+// Four channels at a gain of 8 add up to 32 times a sample, so the mix
+// never leaves the range of a sample.
+#define MIX_SHIFT (5)
+
+/*
+ * Mixes <count> samples of every channel into <out>, as interleaved
+ * left and right samples. <left> and <right> are the gains of each
+ * channel, from 0 (off) to 8 (the loudest master volume).
+ */
+void mixer_mix(int16_t* restrict out,
+    const int16_t* const channels[SOUND_CHANNELS],
+    const int16_t left[SOUND_CHANNELS], const int16_t right[SOUND_CHANNELS],
+    size_t count)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Channels are mixed in pairs, _mm_madd_epi16 multiplies both
+    // samples of a pair with their gains and adds them up.
+    const __m128i left01 = _mm_set1_epi32(
+        (uint16_t)left[0] | (uint32_t)(uint16_t)left[1] << 16);
+    const __m128i left23 = _mm_set1_epi32(
+        (uint16_t)left[2] | (uint32_t)(uint16_t)left[3] << 16);
+    const __m128i right01 = _mm_set1_epi32(
+        (uint16_t)right[0] | (uint32_t)(uint16_t)right[1] << 16);
+    const __m128i right23 = _mm_set1_epi32(
+        (uint16_t)right[2] | (uint32_t)(uint16_t)right[3] << 16);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i c[SOUND_CHANNELS];
+
+        for (size_t ch = 0; ch < SOUND_CHANNELS; ch++) {
+            c[ch] = _mm_loadu_si128((const __m128i*)(channels[ch] + i));
+        }
+
+        // Samples 0 to 3 resp. 4 to 7 of both pairs.
+        const __m128i pairs[][2] = {
+            { _mm_unpacklo_epi16(c[0], c[1]), _mm_unpacklo_epi16(c[2], c[3]) },
+            { _mm_unpackhi_epi16(c[0], c[1]), _mm_unpackhi_epi16(c[2], c[3]) },
+        };
+        __m128i l[2], r[2];
+
+        for (size_t half = 0; half < 2; half++) {
+            l[half] = _mm_srai_epi32(_mm_add_epi32(
+                _mm_madd_epi16(pairs[half][0], left01),
+                _mm_madd_epi16(pairs[half][1], left23)), MIX_SHIFT);
+            r[half] = _mm_srai_epi32(_mm_add_epi32(
+                _mm_madd_epi16(pairs[half][0], right01),
+                _mm_madd_epi16(pairs[half][1], right23)), MIX_SHIFT);
+        }
+
+        const __m128i l16 = _mm_packs_epi32(l[0], l[1]);
+        const __m128i r16 = _mm_packs_epi32(r[0], r[1]);
+
+        _mm_storeu_si128((__m128i*)(out + 2 * i),
+            _mm_unpacklo_epi16(l16, r16));
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 8),
+            _mm_unpackhi_epi16(l16, r16));
+    }
+#endif
+
+    for (; i < count; i++) {
+        int32_t l = 0, r = 0;
+
+        for (size_t ch = 0; ch < SOUND_CHANNELS; ch++) {
+            l += channels[ch][i] * left[ch];
+            r += channels[ch][i] * right[ch];
+        }
+
+        out[2 * i] = l >> MIX_SHIFT;
+        out[2 * i + 1] = r >> MIX_SHIFT;
+    }
+}
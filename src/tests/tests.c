@@ -6,24 +6,39 @@
 //  Copyright (c) 2012 Lorenz. All rights reserved.
 //
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <check.h>
 #include <assert.h>
 
 #include "context.h"
+#include "buffers.h"
 #include "cpu_ops.h"
 #include "set.h"
 #include "ioregs.h"
+#include "joypad.h"
+#include "snapshot.h"
+#include "graphics/record.h"
+#include "sound/mixer.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 // Fixtures
 context_t ctx;
 
 void setup_cpu(void)
 {
-    context_init_minimal(&ctx);
+    context_init_minimal(&ctx, true);
+}
+
+void teardown_cpu(void)
+{
+    context_destroy_minimal(&ctx);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -573,6 +588,676 @@ END_TEST
 // }
 // END_TEST
 
+START_TEST (test_gfx_frame_skip)
+{
+    unsigned int vblanks = 0;
+    uint64_t drawn, skipped;
+
+    ctx.mem.io.LCDC = 0x91;
+    graphics_set_frame_skip(&ctx, 3);
+
+    while (vblanks < 7) {
+        graphics_update(&ctx, 4);
+
+        if (ctx.mem.io.IF & (1 << I_VBLANK)) {
+            ctx.mem.io.IF &= ~(1 << I_VBLANK);
+            vblanks++;
+        }
+    }
+
+    graphics_get_frame_stats(&ctx, &drawn, &skipped);
+
+    // The current and the next frame are drawn, then every third.
+    fail_unless(drawn == 3, "drawn %d frames", (int)drawn);
+    fail_unless(skipped == 4, "skipped %d frames", (int)skipped);
+    fail_unless(ctx.mem.io.LY == 144);
+}
+END_TEST
+
+static void gfx_run_frame(context_t* ctx)
+{
+    do {
+        graphics_update(ctx, 4);
+    } while (!(ctx->mem.io.IF & (1 << I_VBLANK)));
+
+    ctx->mem.io.IF &= ~(1 << I_VBLANK);
+}
+
+START_TEST (test_gfx_frame_hash)
+{
+    const uint8_t* fb = context_get_framebuffer(&ctx);
+    const uint64_t blank = context_get_frame_hash(&ctx);
+
+    fail_unless(fb[0] == 0 && fb[SCREEN_WIDTH * SCREEN_HEIGHT - 1] == 0);
+
+    ctx.mem.io.LCDC = 0x91;
+    ctx.mem.io.BGP = 0xE4;
+
+    // Tile 0 is blank, too.
+    gfx_run_frame(&ctx);
+    fail_unless(context_get_frame_hash(&ctx) == blank);
+
+    // Fill tile 0 with color 3.
+    for (uint16_t addr = 0x8000; addr < 0x8010; addr++) {
+        mem_write(&ctx, addr, 0xFF);
+    }
+
+    gfx_run_frame(&ctx);
+    fb = context_get_framebuffer(&ctx);
+
+    const uint64_t black = context_get_frame_hash(&ctx);
+
+    fail_unless(black != blank);
+    fail_unless(fb[0] == 3 && fb[SCREEN_WIDTH * SCREEN_HEIGHT - 1] == 3);
+
+    gfx_run_frame(&ctx);
+    fail_unless(context_get_frame_hash(&ctx) == black);
+}
+END_TEST
+
+START_TEST (test_gfx_observation)
+{
+    const uint8_t* obs;
+    size_t len;
+
+    ctx.mem.io.LCDC = 0x91;
+    ctx.mem.io.BGP = 0xE4;
+
+    // Left half of tile 0 is color 3, the right half color 0.
+    for (uint16_t addr = 0x8000; addr < 0x8010; addr++) {
+        mem_write(&ctx, addr, 0xF0);
+    }
+
+    fail_unless(graphics_set_observation(&ctx, OBSERVE_2BPP, SCREEN_WIDTH,
+        SCREEN_HEIGHT, false));
+    gfx_run_frame(&ctx);
+
+    obs = graphics_get_observation(&ctx, &len);
+    fail_unless(len == 5760);
+    fail_unless(obs[0] == 0xFF && obs[1] == 0x00);
+
+    // Every pixel averages a dark and a white one.
+    fail_unless(graphics_set_observation(&ctx, OBSERVE_GREY, 20, 72, false));
+    gfx_run_frame(&ctx);
+
+    obs = graphics_get_observation(&ctx, &len);
+    fail_unless(len == 20 * 72);
+    fail_unless(obs[0] == 0x80 && obs[len - 1] == 0x80);
+}
+END_TEST
+
+START_TEST (test_gfx_observation_pooled)
+{
+    uint64_t drawn, skipped, seen = 0;
+    const uint8_t* obs;
+    size_t len;
+
+    ctx.mem.io.LCDC = 0x91;
+    ctx.mem.io.BGP = 0xE4;
+
+    fail_unless(graphics_set_observation(&ctx, OBSERVE_GREY, SCREEN_WIDTH,
+        SCREEN_HEIGHT, true));
+    graphics_set_frame_skip(&ctx, 2);
+
+    // The screen flickers between black and white, and only every other
+    // frame is drawn. _i selects which ones.
+    for (int frame = 0; frame < 8; frame++) {
+        for (uint16_t addr = 0x8000; addr < 0x8010; addr++) {
+            mem_write(&ctx, addr, (frame + _i) % 2 ? 0xFF : 0x00);
+        }
+
+        gfx_run_frame(&ctx);
+        graphics_get_frame_stats(&ctx, &drawn, &skipped);
+
+        if (drawn == seen) {
+            continue;
+        }
+
+        // Pooled with the skipped frame before it, unless it is the first.
+        obs = graphics_get_observation(&ctx, &len);
+        fail_unless(seen == 0 || obs[0] == 0x00, "frame %d is not black",
+            frame);
+        seen = drawn;
+    }
+
+    // The current and the next frame are drawn, then every other.
+    fail_unless(seen == 5 && skipped == 3);
+}
+END_TEST
+
+static void gfx_write_sprite(context_t* ctx, int index, int x, int y,
+    uint8_t tile, uint8_t flags)
+{
+    const uint16_t addr = 0xFE00 + index * SPRITE_SIZE;
+
+    mem_write(ctx, addr + 0, y + 16);
+    mem_write(ctx, addr + 1, x + 8);
+    mem_write(ctx, addr + 2, tile);
+    mem_write(ctx, addr + 3, flags);
+}
+
+/*
+ * Sets up a scene that has to look the same with every PPU backend.
+ */
+static void gfx_scene(context_t* ctx, int scene)
+{
+    static const uint8_t lcdc[] = { 0x91, 0xF1, 0x93, 0x87, 0xB3 };
+
+    for (uint8_t y = 0; y < TILE_HEIGHT; y++) {
+        // Tile 1 has all four colors, tile 2 a diagonal line and tile 3
+        // a transparent border. Each is also stored for signed ids.
+        const uint8_t lines[][2] = {
+            { 0x0F, 0x33 },
+            { 0x80 >> y, 0x01 << y },
+            { 0x7E, y > 0 && y < 7 ? 0x3C : 0x00 },
+        };
+
+        for (uint16_t tile = 1; tile <= 3; tile++) {
+            for (uint16_t plane = 0; plane < 2; plane++) {
+                const uint16_t offset = tile * 16 + y * 2 + plane;
+
+                mem_write(ctx, 0x8000 + offset, lines[tile - 1][plane]);
+                mem_write(ctx, 0x9000 + offset, lines[tile - 1][plane]);
+            }
+        }
+    }
+
+    for (uint16_t i = 0; i < MAP_ROWS * MAP_COLUMNS; i++) {
+        mem_write(ctx, 0x9800 + i, (i / MAP_COLUMNS * 5 + i) % 4);
+        mem_write(ctx, 0x9C00 + i, (i / MAP_COLUMNS + i) % 3 + 1);
+    }
+
+    // Eleven sprites on the same lines, the last one is not displayed.
+    // Some are flipped, overlap or are partially off screen.
+    for (int i = 0; i < 11; i++) {
+        gfx_write_sprite(ctx, i, i * 14 - 4, 30 + (i % 2) * 3,
+            i % 2 ? 3 : 2, (i / 2 % 4) << 5);
+    }
+    gfx_write_sprite(ctx, 11, 60, 90, 3, 0x80);
+    gfx_write_sprite(ctx, 12, 64, 92, 1, 0x10);
+    gfx_write_sprite(ctx, 13, 155, 120, 2, 0x00);
+
+    ctx->mem.io.BGP = 0xE4;
+    ctx->mem.io.SPP_LOW = 0xE4;
+    ctx->mem.io.SPP_HIGH = 0x1B;
+    ctx->mem.io.SCX = scene * 13;
+    ctx->mem.io.SCY = scene * 37;
+    ctx->mem.io.WX = scene == 4 ? 3 : 47;
+    ctx->mem.io.WY = scene == 4 ? 0 : 40;
+    ctx->mem.io.LCDC = lcdc[scene];
+}
+
+START_TEST (test_gfx_backends)
+{
+    const uint64_t blank = context_get_frame_hash(&ctx);
+    uint64_t hashes[2];
+
+    gfx_scene(&ctx, _i);
+
+    for (int backend = PPU_FAST; backend <= PPU_ACCURATE; backend++) {
+        graphics_set_backend(&ctx, backend);
+        gfx_run_frame(&ctx);
+        gfx_run_frame(&ctx);
+
+        hashes[backend] = context_get_frame_hash(&ctx);
+    }
+
+    fail_unless(hashes[PPU_FAST] != blank);
+    fail_unless(hashes[PPU_FAST] == hashes[PPU_ACCURATE],
+        "scene %d is drawn differently", _i);
+}
+END_TEST
+
+/*
+ * Runs a frame that changes the scroll registers on every line, more
+ * often than the fast backend can log for a frame.
+ */
+static void gfx_run_raster_frame(context_t* ctx)
+{
+    uint8_t ly = ctx->mem.io.LY;
+
+    do {
+        graphics_update(ctx, 4);
+
+        if (ctx->mem.io.LY != ly && ctx->mem.io.LY < SCREEN_HEIGHT) {
+            ly = ctx->mem.io.LY;
+
+            mem_write(ctx, offsetof(memory_io_t, SCX), ly);
+            mem_write(ctx, offsetof(memory_io_t, SCY), ly / 2);
+            mem_write(ctx, offsetof(memory_io_t, SCX), ly * 3);
+        }
+    } while (!(ctx->mem.io.IF & (1 << I_VBLANK)));
+
+    ctx->mem.io.IF &= ~(1 << I_VBLANK);
+}
+
+START_TEST (test_gfx_raster_writes)
+{
+    uint64_t hashes[2];
+
+    gfx_scene(&ctx, 0);
+
+    for (int backend = PPU_FAST; backend <= PPU_ACCURATE; backend++) {
+        graphics_set_backend(&ctx, backend);
+        gfx_run_raster_frame(&ctx);
+        gfx_run_raster_frame(&ctx);
+
+        hashes[backend] = context_get_frame_hash(&ctx);
+    }
+
+    fail_unless(hashes[PPU_FAST] == hashes[PPU_ACCURATE]);
+}
+END_TEST
+
+START_TEST (test_gfx_record)
+{
+    static const uint8_t shades[] = { 0xFF, 0xCC, 0x77, 0x00 };
+    static frame_t frame;
+    const char* header = "";
+    const char* frame_header = "";
+    size_t pixel_size = 1;
+    char filename[32];
+    size_t size;
+
+    strcpy(filename, "/tmp/spielbub-XXXXXX");
+    close(mkstemp(filename));
+
+    recorder_t* recorder = recorder_open(filename, _i, 3, SCALE_NEAREST, 1);
+    ck_assert(recorder != NULL);
+
+    // Seven frames of which the first, fourth and seventh are recorded.
+    // Each line counts up through the colors from the frame's number.
+    for (int i = 0; i < 7; i++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                frame.pixels[y][x] = (x + i) & 3;
+            }
+        }
+
+        frame.hash = i;
+        recorder_push(recorder, &frame);
+    }
+
+    ck_assert(recorder_close(recorder));
+
+    FILE* file = fopen(filename, "rb");
+    ck_assert(file != NULL);
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    uint8_t* contents = malloc(size);
+    ck_assert_uint_eq(fread(contents, 1, size, file), size);
+    fclose(file);
+    unlink(filename);
+
+    switch (_i) {
+    case RECORD_Y4M:
+        header = "YUV4MPEG2 W160 H144 F262144:13167 Ip A1:1 Cmono\n";
+        frame_header = "FRAME\n";
+        break;
+
+    case RECORD_PPM:
+        frame_header = "P6\n160 144\n255\n";
+        pixel_size = 3;
+        break;
+    }
+
+    const size_t pixels = _i == RECORD_2BPP ?
+        SCREEN_WIDTH * SCREEN_HEIGHT / 4 :
+        SCREEN_WIDTH * SCREEN_HEIGHT * pixel_size;
+    const size_t frame_size = strlen(frame_header) + pixels;
+
+    ck_assert_uint_eq(size, strlen(header) + 3 * frame_size);
+    ck_assert(memcmp(contents, header, strlen(header)) == 0);
+
+    for (int recorded = 0; recorded < 3; recorded++) {
+        const uint8_t* p = contents + strlen(header) + recorded * frame_size;
+        const int i = recorded * 3;
+
+        ck_assert(memcmp(p, frame_header, strlen(frame_header)) == 0);
+        p += strlen(frame_header);
+
+        if (_i == RECORD_2BPP) {
+            // The leftmost pixel is in the upper bits.
+            ck_assert_uint_eq(p[0], (i & 3) << 6 | ((i + 1) & 3) << 4 |
+                ((i + 2) & 3) << 2 | ((i + 3) & 3));
+        } else {
+            for (int x = 0; x < 4; x++) {
+                ck_assert_uint_eq(p[x * pixel_size], shades[(x + i) & 3]);
+            }
+        }
+    }
+
+    free(contents);
+}
+END_TEST
+
+// Reads from the pipe until the recorder closes it.
+static int gfx_drain_pipe(void* data)
+{
+    int* fd = data;
+    uint8_t buffer[4096];
+    ssize_t n;
+    int total = 0;
+
+    while ((n = read(*fd, buffer, sizeof buffer)) > 0) {
+        total += n;
+    }
+
+    return total;
+}
+
+START_TEST (test_gfx_record_dropped)
+{
+    static frame_t frame;
+    char filename[32];
+    int fd, bytes;
+    unsigned int pushed = 0;
+
+    strcpy(filename, "/tmp/spielbub-XXXXXX");
+    close(mkstemp(filename));
+    unlink(filename);
+    ck_assert(mkfifo(filename, 0600) == 0);
+
+    fd = open(filename, O_RDONLY | O_NONBLOCK);
+    ck_assert(fd >= 0);
+
+    recorder_t* recorder = recorder_open(filename, RECORD_2BPP, 1,
+        SCALE_NEAREST, 1);
+    ck_assert(recorder != NULL);
+
+    // Nothing is read yet, so the writer blocks once the pipe is full
+    // and the queue fills up.
+    while (atomic_load(&recorder->writer->dropped) == 0) {
+        frame.hash = pushed++;
+        recorder_push(recorder, &frame);
+    }
+
+    fcntl(fd, F_SETFL, 0);
+    SDL_Thread* thread = SDL_CreateThread(gfx_drain_pipe, "drain", &fd);
+
+    // Everything else is still written.
+    ck_assert(!recorder_close(recorder));
+    SDL_WaitThread(thread, &bytes);
+
+    ck_assert_uint_eq((unsigned int)bytes,
+        (pushed - 1) * SCREEN_WIDTH * SCREEN_HEIGHT / 4);
+
+    close(fd);
+    unlink(filename);
+}
+END_TEST
+
+/*
+ * Changes a single tile byte, map byte or LCDC bit 4 between two frames,
+ * which must invalidate the fast backend's cached planes.
+ */
+START_TEST (test_gfx_planes)
+{
+    const uint16_t addrs[] = { 0x8010, 0x9800, offsetof(memory_io_t, LCDC) };
+    const uint8_t values[] = { 0xAA, 0x03, 0x81 };
+    uint64_t hashes[2];
+
+    for (int backend = PPU_FAST; backend <= PPU_ACCURATE; backend++) {
+        gfx_scene(&ctx, 0);
+
+        // Signed tile 1 differs from unsigned tile 1.
+        mem_write(&ctx, 0x9010, 0xFF);
+
+        graphics_set_backend(&ctx, backend);
+        gfx_run_frame(&ctx);
+        gfx_run_frame(&ctx);
+
+        const uint64_t before = context_get_frame_hash(&ctx);
+
+        mem_write(&ctx, addrs[_i], values[_i]);
+        gfx_run_frame(&ctx);
+
+        hashes[backend] = context_get_frame_hash(&ctx);
+        fail_unless(hashes[backend] != before);
+    }
+
+    fail_unless(hashes[PPU_FAST] == hashes[PPU_ACCURATE],
+        "change %d is drawn differently", _i);
+}
+END_TEST
+
+START_TEST (test_gfx_dma)
+{
+    const uint8_t page = ctx.mem.io.DMA;
+    uint64_t hashes[2];
+
+    for (int backend = PPU_FAST; backend <= PPU_ACCURATE; backend++) {
+        gfx_scene(&ctx, 2);
+        graphics_set_backend(&ctx, backend);
+        gfx_run_frame(&ctx);
+
+        // Hide all sprites from the middle of the screen on, with the
+        // page that the DMA register already holds.
+        memset(&ctx.mem.map[page * 0x100], 0, 0xA0);
+
+        while (ctx.mem.io.LY != SCREEN_HEIGHT / 2) {
+            graphics_update(&ctx, 4);
+        }
+
+        mem_write(&ctx, offsetof(memory_io_t, DMA), page);
+        fail_unless(ctx.mem.gfx.oam[0].data[0] == 0);
+
+        gfx_run_frame(&ctx);
+        hashes[backend] = context_get_frame_hash(&ctx);
+    }
+
+    fail_unless(hashes[PPU_FAST] == hashes[PPU_ACCURATE]);
+}
+END_TEST
+
+/*
+ * Runs until the next line is transferred to the LCD and returns how
+ * many dots that took.
+ */
+static int gfx_transfer_length(context_t* ctx)
+{
+    int dots = 1;
+
+    while ((ctx->mem.io.STAT & 0x3) == TRANSF) {
+        graphics_update(ctx, 1);
+    }
+
+    while ((ctx->mem.io.STAT & 0x3) != TRANSF) {
+        graphics_update(ctx, 1);
+    }
+
+    for (; (ctx->mem.io.STAT & 0x3) == TRANSF; dots++) {
+        graphics_update(ctx, 1);
+    }
+
+    return dots;
+}
+
+START_TEST (test_gfx_transfer_length)
+{
+    ctx.mem.io.LCDC = 0x93;
+    graphics_set_backend(&ctx, PPU_ACCURATE);
+
+    fail_unless(gfx_transfer_length(&ctx) == 172);
+
+    // Scrolled pixels are discarded.
+    ctx.mem.io.SCX = 3;
+    fail_unless(gfx_transfer_length(&ctx) == 175);
+
+    // Fetching a sprite stalls the output.
+    gfx_write_sprite(&ctx, 0, 40, ctx.mem.io.LY + 1, 0, 0);
+    fail_unless(gfx_transfer_length(&ctx) == 181);
+}
+END_TEST
+
+/*
+ * Runs a frame and stores how many dots each line spent in mode 3.
+ */
+static void gfx_run_timed_frame(context_t* ctx, int dots[SCREEN_HEIGHT])
+{
+    memset(dots, 0, SCREEN_HEIGHT * sizeof dots[0]);
+
+    do {
+        graphics_update(ctx, 1);
+
+        if ((ctx->mem.io.STAT & 0x3) == TRANSF) {
+            dots[ctx->mem.io.LY]++;
+        }
+    } while (!(ctx->mem.io.IF & (1 << I_VBLANK)));
+
+    ctx->mem.io.IF &= ~(1 << I_VBLANK);
+}
+
+START_TEST (test_gfx_transfer_length_skipped)
+{
+    int drawn[SCREEN_HEIGHT], skipped[SCREEN_HEIGHT];
+
+    // Scrolled, with sprites and the window.
+    gfx_scene(&ctx, 4);
+    graphics_set_backend(&ctx, PPU_ACCURATE);
+    graphics_set_frame_skip(&ctx, 2);
+    gfx_run_frame(&ctx);
+
+    gfx_run_timed_frame(&ctx, drawn);
+    fail_unless(!ctx.gfx.skip_frame);
+
+    gfx_run_timed_frame(&ctx, skipped);
+    fail_unless(ctx.gfx.skip_frame);
+
+    fail_unless(drawn[30] > 172);
+    fail_unless(memcmp(drawn, skipped, sizeof drawn) == 0);
+}
+END_TEST
+
+START_TEST (test_gfx_dirty_lines)
+{
+    static window_t window;
+    static frame_t frame;
+    SDL_Rect dirty = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+
+    for (size_t y = 0; y < SCREEN_HEIGHT; y++) {
+        window.shown_hashes[y] = frame.line_hashes[y] = y * 31;
+    }
+
+    // Only the frame hash differs, e.g. after a collision.
+    fail_unless(!window_dirty_lines(&window, &frame, &dirty));
+
+    frame.line_hashes[5] = 1;
+    frame.line_hashes[100] = 1;
+    fail_unless(window_dirty_lines(&window, &frame, &dirty));
+    ck_assert_int_eq(dirty.y, 5);
+    ck_assert_int_eq(dirty.h, 96);
+
+    frame.line_hashes[5] = window.shown_hashes[5];
+    frame.line_hashes[100] = window.shown_hashes[100];
+    frame.line_hashes[0] = 1;
+    fail_unless(window_dirty_lines(&window, &frame, &dirty));
+    ck_assert_int_eq(dirty.y, 0);
+    ck_assert_int_eq(dirty.h, 1);
+
+    frame.line_hashes[0] = window.shown_hashes[0];
+    frame.line_hashes[SCREEN_HEIGHT - 1] = 1;
+    fail_unless(window_dirty_lines(&window, &frame, &dirty));
+    ck_assert_int_eq(dirty.y, SCREEN_HEIGHT - 1);
+    ck_assert_int_eq(dirty.h, 1);
+}
+END_TEST
+
+START_TEST (test_gfx_sprites)
+{
+    const uint8_t* fb;
+
+    // Tile 1 has color 1 on the left and is transparent on the right.
+    for (int y = 0; y < TILE_HEIGHT; y++) {
+        ctx.mem.gfx.tiles.data[1].lines[y][0] = 0xF0;
+    }
+
+    // An 8x16 sprite at 8/8 with tile 1 in its lower half, flipped
+    // horizontally by its flags in byte 3.
+    ctx.mem.gfx.oam[0] = (memory_oam_t){ { 8 + 16, 8 + 8, 0, 0x20 } };
+
+    ctx.mem.io.SPP_LOW = 0xE4;
+    ctx.mem.io.LCDC = 0x97;
+
+    gfx_run_frame(&ctx);
+    fb = context_get_framebuffer(&ctx);
+
+    // The upper half uses the blank tile 0.
+    fail_unless(fb[8 * SCREEN_WIDTH + 15] == 0);
+    fail_unless(fb[16 * SCREEN_WIDTH + 8] == 0);
+    fail_unless(fb[16 * SCREEN_WIDTH + 15] != 0);
+    fail_unless(fb[23 * SCREEN_WIDTH + 12] == fb[16 * SCREEN_WIDTH + 15]);
+    fail_unless(fb[23 * SCREEN_WIDTH + 11] == 0);
+    fail_unless(fb[24 * SCREEN_WIDTH + 15] == 0);
+}
+END_TEST
+
+// Pixels outside of the screen repeat the edges.
+static uint8_t gfx_pixel(const uint8_t* fb, int x, int y)
+{
+    x = MAX(0, MIN(SCREEN_WIDTH - 1, x));
+    y = MAX(0, MIN(SCREEN_HEIGHT - 1, y));
+
+    return fb[y * SCREEN_WIDTH + x];
+}
+
+START_TEST (test_gfx_scale)
+{
+    const uint8_t* fb;
+    const uint8_t* scaled;
+    size_t width, height;
+
+    gfx_scene(&ctx, 2);
+    gfx_run_frame(&ctx);
+    gfx_run_frame(&ctx);
+    fb = context_get_framebuffer(&ctx);
+
+    fail_unless(!graphics_set_scale(&ctx, SCALE_SCALE2X, 5));
+    fail_unless(!graphics_set_scale(&ctx, SCALE_EDGE, 3));
+
+    fail_unless(graphics_set_scale(&ctx, SCALE_NEAREST, 3));
+    scaled = graphics_get_scaled_frame(&ctx, &width, &height);
+    fail_unless(width == 480 && height == 432);
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            fail_unless(scaled[y * width + x] ==
+                fb[y / 3 * SCREEN_WIDTH + x / 3]);
+        }
+    }
+
+    fail_unless(graphics_set_scale(&ctx, SCALE_SCALE2X, 2));
+    scaled = graphics_get_scaled_frame(&ctx, &width, &height);
+    fail_unless(width == 320 && height == 288);
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            const uint8_t B = gfx_pixel(fb, x, y - 1);
+            const uint8_t D = gfx_pixel(fb, x - 1, y);
+            const uint8_t E = gfx_pixel(fb, x, y);
+            const uint8_t F = gfx_pixel(fb, x + 1, y);
+            const uint8_t H = gfx_pixel(fb, x, y + 1);
+            const bool edge = B != H && D != F;
+            const uint8_t* top = scaled + 2 * y * width + 2 * x;
+            const uint8_t* bottom = top + width;
+
+            fail_unless(top[0] == (edge && D == B ? D : E));
+            fail_unless(top[1] == (edge && B == F ? F : E));
+            fail_unless(bottom[0] == (edge && D == H ? D : E));
+            fail_unless(bottom[1] == (edge && H == F ? F : E));
+        }
+    }
+
+    // Unchanged frames are not scaled again.
+    fail_unless(graphics_set_scale(&ctx, SCALE_EDGE, 4));
+    scaled = graphics_get_scaled_frame(&ctx, &width, &height);
+    gfx_run_frame(&ctx);
+    fail_unless(graphics_get_scaled_frame(&ctx, &width, &height) == scaled);
+    fail_unless(ctx.gfx.scaler.scaled == 1);
+}
+END_TEST
+
 /* -------------------------------------------------------------------------- */
 // Memory
 
@@ -631,6 +1316,330 @@ START_TEST (test_set)
 }
 END_TEST
 
+/* -------------------------------------------------------------------------- */
+// Buffers
+
+START_TEST (test_ring_buffer)
+{
+    ring_buffer* rb = rb_init(4, 2);
+    uint16_t in[6] = { 0x0100, 0x0302, 0x0504, 0x0706, 0x0908, 0x0B0A };
+    uint16_t out[6] = { 0 };
+
+    ck_assert_uint_eq(rb_write(rb, in, 3), 3);
+    ck_assert_uint_eq(rb_read(rb, out, 2), 2);
+    ck_assert_uint_eq(out[0], 0x0100);
+    ck_assert_uint_eq(out[1], 0x0302);
+
+    // Only three of the four items fit, the last two wrap around
+    ck_assert_uint_eq(rb_write(rb, in + 3, 4), 3);
+    ck_assert_uint_eq(rb_used(rb), 4);
+    ck_assert_uint_eq(rb_write(rb, in, 1), 0);
+
+    // Reading more than is queued returns what is there, in order
+    memset(out, 0, sizeof(out));
+    ck_assert_uint_eq(rb_read(rb, out, 6), 4);
+    ck_assert_uint_eq(out[0], 0x0504);
+    ck_assert_uint_eq(out[1], 0x0706);
+    ck_assert_uint_eq(out[2], 0x0908);
+    ck_assert_uint_eq(out[3], 0x0B0A);
+    ck_assert_uint_eq(out[4], 0);
+    ck_assert_uint_eq(rb_used(rb), 0);
+    ck_assert_uint_eq(rb_read(rb, out, 1), 0);
+    fail_unless(rb_peek(rb) == NULL, "Queue is not empty after reading everything");
+
+    // Single items and bulk copies share the same positions
+    ck_assert_uint_eq(rb_write(rb, in, 2), 2);
+    ck_assert_uint_eq(*(const uint16_t*)rb_peek(rb), 0x0100);
+    rb_release(rb);
+    ck_assert_uint_eq(rb_read(rb, out, 2), 1);
+    ck_assert_uint_eq(out[0], 0x0302);
+
+    rb_destroy(rb);
+}
+END_TEST
+
+/* -------------------------------------------------------------------------- */
+// Timers
+
+START_TEST (test_timers)
+{
+    const uint16_t DIV = offsetof(memory_io_t, DIV);
+    const uint16_t TIMA = offsetof(memory_io_t, TIMA);
+
+    ctx.cycles = 0x12345;
+    mem_write(&ctx, DIV, 0);
+    ctx.cycles += 0x1234;
+    ck_assert_uint_eq(mem_read(&ctx, DIV), 0x12);
+
+    // 262144 Hz, i.e. every 16 cycles.
+    mem_write(&ctx, DIV, 0);
+    mem_write(&ctx, offsetof(memory_io_t, TMA), 0xF0);
+    mem_write(&ctx, TIMA, 0xFE);
+    mem_write(&ctx, offsetof(memory_io_t, TAC), 0x05);
+    ck_assert_uint_eq(ctx.sched.at[EVT_TIMER], ctx.cycles + 2 * 16);
+
+    ctx.cycles += 16;
+    ck_assert_uint_eq(mem_read(&ctx, TIMA), 0xFF);
+    ck_assert(!scheduler_due(&ctx.sched, ctx.cycles));
+
+    ctx.cycles += 16;
+    scheduler_run(&ctx);
+    ck_assert(ctx.mem.io.IF & (1 << I_TIMER));
+    ck_assert_uint_eq(mem_read(&ctx, TIMA), 0xF0);
+    ck_assert_uint_eq(ctx.sched.at[EVT_TIMER], ctx.cycles + 16 * 16);
+
+    // Reads in between wrap around from TMA, too.
+    ctx.cycles += 40 * 16;
+    ck_assert_uint_eq(mem_read(&ctx, TIMA), 0xF8);
+
+    // A write syncs TIMA first and requests a missed overflow itself.
+    ctx.mem.io.IF = 0;
+    mem_write(&ctx, offsetof(memory_io_t, TAC), 0x00);
+    ck_assert(ctx.mem.io.IF & (1 << I_TIMER));
+    ck_assert_uint_eq(ctx.sched.at[EVT_TIMER], EVENT_NEVER);
+
+    ctx.cycles += 0x1000;
+    ck_assert_uint_eq(mem_read(&ctx, TIMA), 0xF8);
+
+    // Resetting DIV while the selected bit is set clocks TIMA.
+    mem_write(&ctx, offsetof(memory_io_t, TAC), 0x05);
+    ctx.cycles += 8;
+    mem_write(&ctx, DIV, 0);
+    ck_assert_uint_eq(mem_read(&ctx, TIMA), 0xF9);
+    ck_assert_uint_eq(ctx.sched.at[EVT_TIMER], ctx.cycles + 7 * 16);
+}
+END_TEST
+
+START_TEST (test_frame_pacing)
+{
+    // Nanoseconds, a 10 MHz counter and milliseconds.
+    const uint64_t freqs[] = { 1000000000, 10000000, 1000 };
+    const uint64_t freq = freqs[_i];
+
+    ctx.next_run = 0;
+    ctx.next_run_fraction = 0;
+
+    // The fractions of a tick add up, nothing is lost to rounding.
+    for (int frame = 0; frame < 60; frame++) {
+        context_advance_next_run(&ctx, freq);
+    }
+
+    ck_assert_uint_eq(ctx.next_run, 60 * freq * CYCLES_PER_FRAME / CLOCKSPEED);
+}
+END_TEST
+
+/* -------------------------------------------------------------------------- */
+// Joypad
+
+START_TEST (test_joypad)
+{
+    const uint16_t JOYPAD = offsetof(memory_io_t, JOYPAD);
+
+    joypad_init(&ctx);
+
+    // Directions selected, buttons are not visible.
+    mem_write(&ctx, JOYPAD, 0x2F);
+    ctx.mem.io.IF = 0;
+    joypad_press(&ctx, KEY_A);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x2F);
+    ck_assert_uint_eq(ctx.mem.io.IF, 0);
+
+    joypad_press(&ctx, KEY_DOWN);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x27);
+    ck_assert(ctx.mem.io.IF & (1 << I_JOYPAD));
+
+    // Switching groups makes A go low.
+    ctx.mem.io.IF = 0;
+    mem_write(&ctx, JOYPAD, 0x10);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x1E);
+    ck_assert(ctx.mem.io.IF & (1 << I_JOYPAD));
+
+    // Releases never interrupt.
+    ctx.mem.io.IF = 0;
+    joypad_release(&ctx, KEY_A);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x1F);
+    ck_assert_uint_eq(ctx.mem.io.IF, 0);
+
+    // Both groups are combined.
+    mem_write(&ctx, JOYPAD, 0x00);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x07);
+    ck_assert(ctx.mem.io.IF & (1 << I_JOYPAD));
+}
+END_TEST
+
+START_TEST (test_joypad_late_polling)
+{
+    const uint16_t JOYPAD = offsetof(memory_io_t, JOYPAD);
+
+    joypad_init(&ctx);
+
+    // Headless contexts don't have a keyboard to poll.
+    joypad_set_late_polling(&ctx, true);
+    ck_assert(!joypad_get_late_polling(&ctx));
+
+    ctx.headless = false;
+    joypad_set_late_polling(&ctx, true);
+    ck_assert(joypad_get_late_polling(&ctx));
+
+    // Selecting a group polls the keyboard, where no key is held. That
+    // overrides the pressed key.
+    ctx.cycles = CYCLES_PER_FRAME;
+    joypad_press(&ctx, KEY_A);
+    mem_write(&ctx, JOYPAD, 0x10);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x1F);
+    ck_assert_uint_eq(ctx.joypad_polled, ctx.cycles);
+
+    // The keyboard is polled again only after 1/16 of a frame.
+    joypad_press(&ctx, KEY_A);
+    ctx.cycles += CYCLES_PER_FRAME / 16 - 1;
+    mem_write(&ctx, JOYPAD, 0x10);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x1E);
+
+    ctx.cycles++;
+    mem_write(&ctx, JOYPAD, 0x10);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0x3F, 0x1F);
+    ck_assert_uint_eq(ctx.joypad_polled, ctx.cycles);
+
+    ctx.headless = true;
+}
+END_TEST
+
+START_TEST (test_joypad_queue)
+{
+    const uint16_t JOYPAD = offsetof(memory_io_t, JOYPAD);
+
+    joypad_init(&ctx);
+    mem_write(&ctx, JOYPAD, 0x10);
+
+    // Queued out of order, events at the same cycle keep theirs.
+    fail_unless(joypad_queue(&ctx, 200, KEY_B, false));
+    fail_unless(joypad_queue_frame(&ctx, 1, KEY_A, false));
+    fail_unless(joypad_queue(&ctx, 100, KEY_A, true));
+    fail_unless(joypad_queue(&ctx, 200, KEY_B, true));
+    ck_assert_uint_eq(ctx.sched.at[EVT_INPUT], 100);
+
+    ctx.cycles = 99;
+    ck_assert(!scheduler_due(&ctx.sched, ctx.cycles));
+
+    ctx.cycles = 100;
+    scheduler_run(&ctx);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0xF, 0xE);
+    ck_assert_uint_eq(ctx.sched.at[EVT_INPUT], 200);
+
+    ctx.cycles = 250;
+    scheduler_run(&ctx);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0xF, 0xC);
+    ck_assert_uint_eq(ctx.sched.at[EVT_INPUT], CYCLES_PER_FRAME);
+
+    // Events in the past apply right away.
+    fail_unless(joypad_queue(&ctx, 50, KEY_START, true));
+    scheduler_run(&ctx);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0xF, 0x4);
+
+    ctx.cycles = CYCLES_PER_FRAME;
+    scheduler_run(&ctx);
+    ck_assert_uint_eq(mem_read(&ctx, JOYPAD) & 0xF, 0x5);
+    ck_assert_uint_eq(ctx.sched.at[EVT_INPUT], EVENT_NEVER);
+}
+END_TEST
+
+/* -------------------------------------------------------------------------- */
+// Snapshots
+
+START_TEST (test_snapshot)
+{
+    snapshot_t* snap = snapshot_create(&ctx);
+    uint64_t hashes[2], cycles[2];
+    uint8_t tima[2];
+    uint16_t lfsr[2];
+
+    fail_unless(snap != NULL);
+
+    ctx.state = RUNNING;
+    ctx.mem.io.LCDC = 0x91;
+    ctx.mem.io.BGP = 0xE4;
+    mem_write(&ctx, offsetof(memory_io_t, TAC), 0x05);
+    mem_write(&ctx, offsetof(memory_sound_t, NR52), 0x80);
+    mem_write(&ctx, offsetof(memory_sound_t, NR42), 0xF0);
+    mem_write(&ctx, offsetof(memory_sound_t, NR44), 0x80);
+
+    fail_unless(context_run_frames(&ctx, 1));
+    snapshot_save(snap, &ctx);
+
+    // Running the same frames again after restoring gives the same
+    // results, including the changes to VRAM.
+    for (size_t run = 0; run < 2; run++) {
+        for (uint16_t addr = 0x8000; addr < 0x8010; addr++) {
+            mem_write(&ctx, addr, 0xFF);
+        }
+
+        fail_unless(context_run_frames(&ctx, 3));
+
+        hashes[run] = context_get_frame_hash(&ctx);
+        cycles[run] = ctx.cycles;
+        tima[run] = mem_read(&ctx, offsetof(memory_io_t, TIMA));
+        lfsr[run] = ctx.snd.noise.lfsr;
+
+        snapshot_restore(snap, &ctx);
+
+        for (uint16_t addr = 0x8000; addr < 0x8010; addr++) {
+            ck_assert_uint_eq(mem_read(&ctx, addr), 0);
+        }
+    }
+
+    ck_assert_uint_eq(cycles[0], cycles[1]);
+    ck_assert_uint_eq(tima[0], tima[1]);
+    ck_assert_uint_eq(lfsr[0], lfsr[1]);
+    ck_assert_uint_eq(hashes[0], hashes[1]);
+
+    snapshot_free(snap);
+}
+END_TEST
+
+START_TEST (test_run_ahead)
+{
+    uint64_t drawn, skipped;
+
+    ctx.state = RUNNING;
+    ctx.mem.io.LCDC = 0x91;
+    ctx.mem.io.BGP = 0xE4;
+
+    // Frame skipping still applies to the frames shown.
+    graphics_set_frame_skip(&ctx, 2);
+    fail_unless(context_run_frames(&ctx, 1));
+    fail_unless(context_set_run_ahead(&ctx, 1));
+
+    // The frame in progress was started before, and might still be drawn.
+    fail_unless(context_run_frame_ahead(&ctx));
+    graphics_get_frame_stats(&ctx, &drawn, &skipped);
+
+    for (uint64_t frame = 1; frame <= 10; frame++) {
+        const uint64_t cycles = ctx.cycles;
+
+        fail_unless(context_run_frame_ahead(&ctx));
+
+        // Frames run ahead are undone again.
+        fail_unless(ctx.cycles >= cycles + CYCLES_PER_FRAME);
+        fail_unless(ctx.cycles < cycles + CYCLES_PER_FRAME + 32);
+        fail_unless(!ctx.gfx.hidden && !ctx.snd.muted);
+    }
+
+    uint64_t now;
+    graphics_get_frame_stats(&ctx, &now, &skipped);
+    ck_assert_uint_eq(now - drawn, 5);
+
+    // Without frame skipping, every frame is shown.
+    graphics_set_frame_skip(&ctx, 0);
+    graphics_get_frame_stats(&ctx, &drawn, &skipped);
+
+    for (uint64_t frame = 1; frame <= 4; frame++) {
+        fail_unless(context_run_frame_ahead(&ctx));
+        graphics_get_frame_stats(&ctx, &now, &skipped);
+        ck_assert_uint_eq(now - drawn, frame);
+    }
+}
+END_TEST
+
 static const int waveform_cycles = 8; // one full waveform at max freq.
 
 START_TEST(test_sound_square_freq)
@@ -694,6 +1703,290 @@ START_TEST(test_sound_square_freq)
     ck_assert_mem_eq(&buffer[sizeof(_65536hz_75duty)], _65536hz_75duty, sizeof(_65536hz_75duty));
 }
 END_TEST
+
+START_TEST(test_sound_square_bulk)
+{
+    const sound_square_params_t params = {
+        .period_lsb = 0x3a + _i * 0x51,
+        .period_msb = 0x07 - _i % 3,
+        .duty = _i % 4,
+    };
+
+    sound_square_state_t single = { .divider = 0x700, .volume = 0b1111 };
+    sound_square_state_t bulk = single;
+    sound_square_state_t output = single;
+    blip_t blip;
+
+    ck_assert(blip_init(&blip, CLOCKSPEED, 44100, 4096));
+
+    // Running the channel in chunks of any size has to match running it
+    // tick by tick, with or without output.
+    for (unsigned int ticks = 1; ticks < 3000; ticks = ticks * 3 + 1) {
+        for (unsigned int i = 0; i < ticks; i++) {
+            sound_update_square(&single, &params);
+        }
+
+        sound_run_square(&bulk, &params, ticks, NULL, 0);
+        sound_run_square(&output, &params, ticks, &blip, 0);
+        blip_end_frame(&blip, ticks * 4);
+        blip_discard(&blip, blip_samples_avail(&blip));
+
+        ck_assert_uint_eq(bulk.divider, single.divider);
+        ck_assert_uint_eq(bulk.wave_step, single.wave_step);
+        ck_assert_uint_eq(bulk.value, single.value);
+        ck_assert(memcmp(&output, &bulk, sizeof bulk) == 0);
+    }
+
+    blip_destroy(&blip);
+}
+END_TEST
+
+START_TEST(test_sound_noise_table)
+{
+    // Both widths, with and without the shift.
+    const sound_noise_params_t params = {
+        .divisor_code = _i % 8,
+        .clock_shift = _i / 4,
+        .lfsr_width = _i % 2,
+    };
+
+    sound_noise_state_t single = { .divider = 5, .lfsr = 0x7fff - _i * 0x111, .volume = 0b1111 };
+    sound_noise_state_t bulk = single;
+    sound_noise_state_t output = single;
+    blip_t blip;
+
+    single.value = bulk.value = output.value = (single.lfsr & 1) ? 0 : 0xff;
+
+    ck_assert(blip_init(&blip, CLOCKSPEED, 44100, 4096));
+
+    // Looking up the sequence has to match clocking the register, with
+    // or without output.
+    for (uint32_t cycles = 4; cycles < 60000; cycles = cycles * 3 + 4) {
+        for (uint32_t i = 0; i < cycles; i += 4) {
+            sound_run_noise(&single, &params, 4, NULL, 0);
+        }
+
+        sound_run_noise(&bulk, &params, cycles, NULL, 0);
+        sound_run_noise(&output, &params, cycles, &blip, 0);
+        blip_end_frame(&blip, cycles);
+        blip_discard(&blip, blip_samples_avail(&blip));
+
+        ck_assert_uint_eq(bulk.divider, single.divider);
+        ck_assert_uint_eq(bulk.lfsr, single.lfsr);
+        ck_assert_uint_eq(bulk.value, single.value);
+        ck_assert(memcmp(&output, &bulk, sizeof bulk) == 0);
+    }
+
+    blip_destroy(&blip);
+}
+END_TEST
+
+START_TEST(test_sound_blip)
+{
+    int16_t samples[64];
+    blip_t blip;
+
+    ck_assert(blip_init(&blip, CLOCKSPEED, 44100, 4096));
+
+    // A step is spread over a few samples, then the output follows it
+    // until the high pass slowly pulls it back to zero.
+    blip_add_delta(&blip, 10, 1000);
+    blip_end_frame(&blip, CLOCKSPEED / 44100 * 64);
+    ck_assert_uint_eq(blip_read_samples(&blip, samples, 64), 63);
+
+    ck_assert(samples[0] == 0);
+    ck_assert(samples[20] > 950 && samples[20] <= 1000);
+    ck_assert(samples[62] < samples[20] && samples[62] > 850);
+
+    for (size_t i = 0; i < 63; i++) {
+        ck_assert(samples[i] >= -100 && samples[i] <= 1100);
+    }
+
+    blip_destroy(&blip);
+}
+END_TEST
+START_TEST(test_sound_channels)
+{
+    const uint16_t NR52 = offsetof(memory_sound_t, NR52);
+
+    mem_write(&ctx, NR52, 0x80);
+
+    // A trigger enables the first channel, until its length of a single
+    // step runs out.
+    mem_write(&ctx, offsetof(memory_sound_t, NR12), 0xF0);
+    mem_write(&ctx, offsetof(memory_sound_t, NR11), 0x3F);
+    mem_write(&ctx, offsetof(memory_sound_t, NR14), 0xC7);
+    ck_assert_uint_eq(mem_read(&ctx, NR52) & 0x0F, 0x01);
+
+    ctx.cycles += 3 * CLOCKSPEED / 512;
+    scheduler_run(&ctx);
+    ck_assert_uint_eq(mem_read(&ctx, NR52) & 0x0F, 0x00);
+
+    // Without length the wave and noise channels keep playing, until
+    // their DAC is turned off.
+    mem_write(&ctx, offsetof(memory_sound_t, NR30), 0x80);
+    mem_write(&ctx, offsetof(memory_sound_t, NR32), 0x20);
+    mem_write(&ctx, offsetof(memory_sound_t, NR34), 0x87);
+    mem_write(&ctx, offsetof(memory_sound_t, NR42), 0xF0);
+    mem_write(&ctx, offsetof(memory_sound_t, NR44), 0x80);
+    ck_assert_uint_eq(mem_read(&ctx, NR52) & 0x0F, 0x0C);
+
+    for (size_t frame = 0; frame < 60; frame++) {
+        ctx.cycles += CYCLES_PER_FRAME;
+        scheduler_run(&ctx);
+        sound_end_frame(&ctx);
+    }
+
+    ck_assert_uint_eq(mem_read(&ctx, NR52) & 0x0F, 0x0C);
+
+    mem_write(&ctx, offsetof(memory_sound_t, NR42), 0x00);
+    ck_assert_uint_eq(mem_read(&ctx, NR52) & 0x0F, 0x04);
+
+    // Powering off stops everything.
+    mem_write(&ctx, NR52, 0x00);
+    ck_assert_uint_eq(mem_read(&ctx, NR52) & 0x8F, 0x00);
+}
+END_TEST
+
+START_TEST(test_sound_sequencer)
+{
+    mem_write(&ctx, offsetof(memory_sound_t, NR52), 0x80);
+
+    const uint8_t step = ctx.snd.sequencer;
+
+    // The sequencer follows bit 12 of the divider, i.e. bit 4 of DIV.
+    ctx.timers.divider_base = ctx.cycles - 0x1F00;
+    sound_schedule_sequencer(&ctx);
+    ck_assert_uint_eq(ctx.sched.at[EVT_SEQUENCER], ctx.cycles + 0x100);
+
+    ctx.cycles += 0x100;
+    ck_assert(scheduler_due(&ctx.sched, ctx.cycles));
+    scheduler_run(&ctx);
+    ck_assert_uint_eq(ctx.snd.sequencer, (step + 1) % 8);
+    ck_assert_uint_eq(ctx.sched.at[EVT_SEQUENCER], ctx.cycles + 0x2000);
+
+    // Resetting DIV while the bit is set makes it fall right away,
+    // resetting it while clear only moves the next step.
+    ctx.timers.divider_base = ctx.cycles - 0x1000;
+    mem_write(&ctx, offsetof(memory_io_t, DIV), 0x42);
+    ck_assert_uint_eq(mem_read(&ctx, offsetof(memory_io_t, DIV)), 0);
+    ck_assert_uint_eq(ctx.snd.sequencer, (step + 2) % 8);
+    ck_assert_uint_eq(ctx.sched.at[EVT_SEQUENCER], ctx.cycles + 0x2000);
+
+    ctx.cycles += 0x800;
+    mem_write(&ctx, offsetof(memory_io_t, DIV), 0x42);
+    ck_assert_uint_eq(ctx.snd.sequencer, (step + 2) % 8);
+    ck_assert_uint_eq(ctx.sched.at[EVT_SEQUENCER], ctx.cycles + 0x2000);
+}
+END_TEST
+
+START_TEST(test_sound_capture)
+{
+    char filenames[2][32];
+    uint8_t* contents[2];
+    size_t sizes[2];
+
+    // The same run has to capture the same samples.
+    for (size_t run = 0; run < 2; run++) {
+        if (run > 0) {
+            teardown_cpu();
+            setup_cpu();
+        }
+
+        strcpy(filenames[run], "/tmp/spielbub-XXXXXX");
+        close(mkstemp(filenames[run]));
+
+        mem_write(&ctx, offsetof(memory_sound_t, NR52), 0x80);
+        mem_write(&ctx, offsetof(memory_sound_t, NR50), 0x77);
+        mem_write(&ctx, offsetof(memory_sound_t, NR51), 0x80);
+        mem_write(&ctx, offsetof(memory_sound_t, NR42), 0xF0);
+        mem_write(&ctx, offsetof(memory_sound_t, NR43), 0x21);
+        mem_write(&ctx, offsetof(memory_sound_t, NR44), 0x80);
+
+        ck_assert(sound_start_capture(&ctx, filenames[run], CAPTURE_WAV, 32000));
+
+        for (size_t frame = 0; frame < 30; frame++) {
+            ctx.cycles += CYCLES_PER_FRAME;
+            scheduler_run(&ctx);
+            sound_end_frame(&ctx);
+        }
+
+        ck_assert(sound_stop_capture(&ctx));
+
+        FILE* file = fopen(filenames[run], "rb");
+        ck_assert(file != NULL);
+        fseek(file, 0, SEEK_END);
+        sizes[run] = ftell(file);
+        rewind(file);
+        contents[run] = malloc(sizes[run]);
+        ck_assert_uint_eq(fread(contents[run], 1, sizes[run], file), sizes[run]);
+        fclose(file);
+        unlink(filenames[run]);
+    }
+
+    ck_assert_uint_eq(sizes[0], sizes[1]);
+    ck_assert(memcmp(contents[0], contents[1], sizes[0]) == 0);
+
+    // 30 frames at 32 kHz, with the sizes filled in.
+    const uint8_t* header = contents[0];
+    const uint32_t data_size = sizes[0] - 44;
+    const size_t frames = data_size / 4;
+
+    ck_assert(memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0);
+    ck_assert_uint_eq((uint32_t)(header[24] | header[25] << 8 | header[26] << 16), 32000);
+    ck_assert_uint_eq((uint32_t)(header[40] | header[41] << 8 | header[42] << 16), data_size);
+    ck_assert_uint_eq(frames, 30ull * CYCLES_PER_FRAME * 32000 / CLOCKSPEED);
+
+    // Noise on the left only.
+    long left = 0, right = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        left += abs((int16_t)(header[44 + 4 * i] | header[45 + 4 * i] << 8));
+        right += abs((int16_t)(header[46 + 4 * i] | header[47 + 4 * i] << 8));
+    }
+
+    ck_assert(left > 0 && right == 0);
+
+    free(contents[0]);
+    free(contents[1]);
+}
+END_TEST
+
+START_TEST(test_sound_mixer)
+{
+    // Enough samples for the vectorised loop and the rest.
+    int16_t channels[SOUND_CHANNELS][13];
+    const int16_t* inputs[SOUND_CHANNELS];
+    const int16_t left[SOUND_CHANNELS] = { 8, 0, 3, 1 };
+    const int16_t right[SOUND_CHANNELS] = { 0, 8, 5, 8 };
+    int16_t out[2 * 13];
+
+    for (size_t ch = 0; ch < SOUND_CHANNELS; ch++) {
+        for (size_t i = 0; i < 13; i++) {
+            channels[ch][i] = (i % 2 ? -1 : 1) * (int)(i * 2500 + ch * 700);
+        }
+
+        inputs[ch] = channels[ch];
+    }
+
+    // Everything at full volume on both sides must not overflow.
+    channels[0][5] = channels[1][5] = channels[2][5] = channels[3][5] = INT16_MIN;
+
+    mixer_mix(out, inputs, left, right, 13);
+
+    for (size_t i = 0; i < 13; i++) {
+        int32_t l = 0, r = 0;
+
+        for (size_t ch = 0; ch < SOUND_CHANNELS; ch++) {
+            l += channels[ch][i] * left[ch];
+            r += channels[ch][i] * right[ch];
+        }
+
+        ck_assert_int_eq(out[2 * i], l >> 5);
+        ck_assert_int_eq(out[2 * i + 1], r >> 5);
+    }
+}
+END_TEST
 /* -------------------------------------------------------------------------- */
 
 Suite * spielbub_suite(void)
@@ -702,7 +1995,7 @@ Suite * spielbub_suite(void)
     
     // CPU test cases
     TCase *tc_cpu = tcase_create("CPU");
-    tcase_add_checked_fixture(tc_cpu, setup_cpu, NULL);
+    tcase_add_checked_fixture(tc_cpu, setup_cpu, teardown_cpu);
     tcase_add_test(tc_cpu, test_cpu_init);
     tcase_add_test(tc_cpu, test_cpu_registers);
     tcase_add_test(tc_cpu, test_cpu_stack);
@@ -722,10 +2015,26 @@ Suite * spielbub_suite(void)
     suite_add_tcase(s, tc_cpu);
     
     // Graphics
-    // TCase *tc_graphics = tcase_create("Graphics");
+    TCase *tc_graphics = tcase_create("Graphics");
+    tcase_add_checked_fixture(tc_graphics, setup_cpu, teardown_cpu);
     // tcase_add_test(tc_graphics, test_gfx_sprite_t);
     // tcase_add_test(tc_graphics, test_gfx_sprite_table);
-    // suite_add_tcase(s, tc_graphics);
+    tcase_add_test(tc_graphics, test_gfx_frame_skip);
+    tcase_add_test(tc_graphics, test_gfx_frame_hash);
+    tcase_add_test(tc_graphics, test_gfx_observation);
+    tcase_add_loop_test(tc_graphics, test_gfx_observation_pooled, 0, 2);
+    tcase_add_loop_test(tc_graphics, test_gfx_backends, 0, 5);
+    tcase_add_test(tc_graphics, test_gfx_raster_writes);
+    tcase_add_loop_test(tc_graphics, test_gfx_planes, 0, 3);
+    tcase_add_loop_test(tc_graphics, test_gfx_record, RECORD_Y4M, RECORD_PPM + 1);
+    tcase_add_test(tc_graphics, test_gfx_record_dropped);
+    tcase_add_test(tc_graphics, test_gfx_dma);
+    tcase_add_test(tc_graphics, test_gfx_transfer_length);
+    tcase_add_test(tc_graphics, test_gfx_transfer_length_skipped);
+    tcase_add_test(tc_graphics, test_gfx_dirty_lines);
+    tcase_add_test(tc_graphics, test_gfx_sprites);
+    tcase_add_test(tc_graphics, test_gfx_scale);
+    suite_add_tcase(s, tc_graphics);
 
     // Memory
     TCase *tc_memory = tcase_create("Memory");
@@ -736,9 +2045,44 @@ Suite * spielbub_suite(void)
     TCase *tc_pl = tcase_create("Set");
     tcase_add_test(tc_pl, test_set);
     suite_add_tcase(s, tc_pl);
+
+    // Buffers
+    TCase *tc_buffers = tcase_create("Buffers");
+    tcase_add_test(tc_buffers, test_ring_buffer);
+    suite_add_tcase(s, tc_buffers);
+
+    // Joypad
+    TCase *tc_joypad = tcase_create("Joypad");
+    tcase_add_checked_fixture(tc_joypad, setup_cpu, teardown_cpu);
+    tcase_add_test(tc_joypad, test_joypad);
+    tcase_add_test(tc_joypad, test_joypad_late_polling);
+    tcase_add_test(tc_joypad, test_joypad_queue);
+    suite_add_tcase(s, tc_joypad);
+
+    // Snapshots
+    TCase *tc_snapshot = tcase_create("Snapshot");
+    tcase_add_checked_fixture(tc_snapshot, setup_cpu, teardown_cpu);
+    tcase_add_test(tc_snapshot, test_snapshot);
+    tcase_add_test(tc_snapshot, test_run_ahead);
+    suite_add_tcase(s, tc_snapshot);
+
+    // Timers
+    TCase *tc_timers = tcase_create("Timers");
+    tcase_add_checked_fixture(tc_timers, setup_cpu, teardown_cpu);
+    tcase_add_test(tc_timers, test_timers);
+    tcase_add_loop_test(tc_timers, test_frame_pacing, 0, 3);
+    suite_add_tcase(s, tc_timers);
     
     TCase *tc_sound = tcase_create("Sound");
+    tcase_add_checked_fixture(tc_sound, setup_cpu, teardown_cpu);
     tcase_add_test(tc_sound, test_sound_square_freq);
+    tcase_add_loop_test(tc_sound, test_sound_square_bulk, 0, 8);
+    tcase_add_test(tc_sound, test_sound_blip);
+    tcase_add_loop_test(tc_sound, test_sound_noise_table, 0, 16);
+    tcase_add_test(tc_sound, test_sound_channels);
+    tcase_add_test(tc_sound, test_sound_sequencer);
+    tcase_add_test(tc_sound, test_sound_mixer);
+    tcase_add_test(tc_sound, test_sound_capture);
     suite_add_tcase(s, tc_sound);
     
     return s;
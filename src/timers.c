@@ -1,50 +1,185 @@
 #include "context.h"
 
 #include "ioregs.h"
+#include "scheduler.h"
 
-#define DIVIDER_FREQUENCY (16384)
-#define DIVIDER_CYCLES (CLOCKSPEED / DIVIDER_FREQUENCY)
+// The frame sequencer steps whenever this bit of the divider falls.
+#define SEQUENCER_BIT (12)
 
-unsigned int const timer_cycles[0x4] = {
-    CLOCKSPEED / 4096,  CLOCKSPEED / 262144,
-    CLOCKSPEED / 65536, CLOCKSPEED / 16384
+// TIMA counts the falling edges of one bit of the divider, selected by
+// TAC. Edges of bit n are 2^(n+1) cycles apart.
+static const unsigned int timer_shifts[0x4] = {
+    10, // 4096 Hz
+    4,  // 262144 Hz
+    6,  // 65536 Hz
+    8   // 16384 Hz
 };
 
-void timers_update(context_t *ctx, int cycles)
+static unsigned int timer_shift(const context_t *ctx)
+{
+    return timer_shifts[tac_timer_type(&ctx->mem)];
+}
+
+/*
+ * Number of times TIMA is incremented after <from> up to and including
+ * <to>, if the timer is enabled.
+ */
+static uint64_t timer_ticks(const context_t *ctx, uint64_t from, uint64_t to)
+{
+    const uint64_t base = ctx->timers.divider_base;
+    const unsigned int shift = timer_shift(ctx);
+
+    return ((to - base) >> shift) - ((from - base) >> shift);
+}
+
+/*
+ * TIMA at <now>, and whether it overflowed since it was last synced.
+ * After an overflow TIMA starts over from TMA, so the remaining ticks
+ * wrap around in the range TMA to 0xFF.
+ */
+static uint8_t timer_at(const context_t *ctx, uint64_t now, bool *overflow)
+{
+    const timers_t *timers = &ctx->timers;
+    const uint8_t tma = ctx->mem.io.TMA;
+
+    *overflow = false;
+
+    if (!tac_enabled(&ctx->mem) || now <= timers->timer_synced) {
+        return timers->tima;
+    }
+
+    uint64_t ticks = timer_ticks(ctx, timers->timer_synced, now);
+    const uint64_t until_overflow = 0x100 - timers->tima;
+
+    if (ticks < until_overflow) {
+        return timers->tima + ticks;
+    }
+
+    *overflow = true;
+    ticks -= until_overflow;
+
+    return tma + ticks % (0x100 - tma);
+}
+
+/*
+ * Brings TIMA up to <now>. Overflows in between request the interrupt,
+ * which only happens here if a write came before EVT_TIMER.
+ */
+static void timer_sync(context_t *ctx, uint64_t now)
 {
     timers_t *timers = &ctx->timers;
-    
-    // Divider
-    timers->divider_cycles += cycles;
-    if (timers->divider_cycles >= DIVIDER_CYCLES)
-    {
-        timers->divider_cycles -= DIVIDER_CYCLES;
-        ctx->mem.io.DIV += 1;
-    }
-    
-    // Timers
-    if (tac_enabled(&ctx->mem))
-    {
-        timers->timer_cycles += cycles;
-        
-        int timer_type = tac_timer_type(&ctx->mem);
-        if (timers->timer_cycles >= timer_cycles[timer_type])
-        {
-            timers->timer_cycles -= timer_cycles[timer_type];
+    bool overflow;
+
+    timers->tima = timer_at(ctx, now, &overflow);
+
+    if (now > timers->timer_synced) {
+        timers->timer_synced = now;
+    }
+
+    if (overflow) {
+        cpu_irq(ctx, I_TIMER);
+    }
+}
+
+/*
+ * Schedules EVT_TIMER for the next overflow of TIMA. This only has to
+ * happen when one of the timer registers changes.
+ */
+static void timer_schedule(context_t *ctx)
+{
+    const timers_t *timers = &ctx->timers;
 
-            ctx->mem.io.TIMA += 1;
+    if (!tac_enabled(&ctx->mem)) {
+        scheduler_cancel(&ctx->sched, EVT_TIMER);
+        return;
+    }
+
+    const unsigned int shift = timer_shift(ctx);
+    const uint64_t edges =
+        (timers->timer_synced - timers->divider_base) >> shift;
+    const uint64_t until_overflow = 0x100 - timers->tima;
+
+    scheduler_schedule(&ctx->sched, EVT_TIMER,
+        timers->divider_base + ((edges + until_overflow) << shift));
+}
+
+void timers_init(context_t *ctx)
+{
+    ctx->timers.divider_base = ctx->cycles;
+    ctx->timers.timer_synced = ctx->cycles;
+    ctx->timers.tima = ctx->mem.io.TIMA;
+
+    timer_schedule(ctx);
+}
+
+/*
+ * The internal 16 bit counter, of which DIV is the upper half.
+ */
+uint16_t timers_divider(const context_t *ctx)
+{
+    return ctx->cycles - ctx->timers.divider_base;
+}
 
-            if (ctx->mem.io.TIMA == 0)
-            {
-                ctx->mem.io.TIMA = ctx->mem.io.TMA;
+uint8_t timers_read(const context_t *ctx, uint16_t addr)
+{
+    bool overflow;
+
+    switch (addr) {
+    case offsetof(memory_io_t, DIV):
+        return timers_divider(ctx) >> 8;
+    case offsetof(memory_io_t, TIMA):
+        return timer_at(ctx, ctx->cycles, &overflow);
+    default:
+        return ctx->mem.map[addr];
+    }
+}
+
+void timers_write(context_t *ctx, uint16_t addr, uint8_t value)
+{
+    timers_t *timers = &ctx->timers;
+
+    timer_sync(ctx, ctx->cycles);
+
+    switch (addr) {
+    case offsetof(memory_io_t, DIV): {
+        // Writing to the Divider Register resets it to zero, regardless
+        // of value. Any bit that was set falls, which clocks TIMA and the
+        // frame sequencer right away.
+        const uint16_t divider = timers_divider(ctx);
+
+        if (tac_enabled(&ctx->mem) &&
+            divider & (1 << (timer_shift(ctx) - 1)))
+        {
+            if (++timers->tima == 0) {
+                timers->tima = ctx->mem.io.TMA;
                 cpu_irq(ctx, I_TIMER);
             }
         }
+
+        timers->divider_base = ctx->cycles;
+        sound_divider_reset(ctx, divider & (1 << SEQUENCER_BIT));
+        break;
     }
-    else
-    {
-        // TODO: Is is correct to reset timer cycles if they are
-        // disabled?
-        timers->timer_cycles = 0;
+    case offsetof(memory_io_t, TIMA):
+        timers->tima = value;
+        break;
+    case offsetof(memory_io_t, TMA):
+        ctx->mem.io.TMA = value;
+        break;
+    case offsetof(memory_io_t, TAC):
+        ctx->mem.io.TAC = value;
+        break;
     }
+
+    timer_schedule(ctx);
+}
+
+/*
+ * TIMA overflowed at <time>. Requests the interrupt and schedules the
+ * next overflow.
+ */
+void timers_overflow_event(context_t *ctx, uint64_t time)
+{
+    timer_sync(ctx, time);
+    timer_schedule(ctx);
 }
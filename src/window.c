@@ -4,26 +4,22 @@
 
 #define PIXEL_FORMAT SDL_PIXELFORMAT_ARGB8888
 
-bool window_init(window_t* window, const char name[], int w, int h)
+/*
+ * Creates the renderer and the streaming texture the size of the window's
+ * surface. SDL only allows using both on the thread that created them.
+ */
+static bool create_renderer(window_t* window)
 {
-    window->window = SDL_CreateWindow(
-        name,
-        SDL_WINDOWPOS_UNDEFINED,
-        SDL_WINDOWPOS_UNDEFINED,
-        w, h,
-        SDL_WINDOW_RESIZABLE
-    );
-
-    if (window->window == NULL) {
-        goto error;
-    }
+    const int w = window->surface->w;
+    const int h = window->surface->h;
 
     window->renderer = SDL_CreateRenderer(window->window, -1, 0);
 
     if (window->renderer == NULL) {
-        goto error;
+        return false;
     }
 
+    SDL_SetRenderDrawColor(window->renderer, 0, 0, 0, 255);
     SDL_RenderSetIntegerScale(window->renderer, SDL_TRUE);
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
     SDL_RenderSetLogicalSize(window->renderer, w, h);
@@ -35,10 +31,42 @@ bool window_init(window_t* window, const char name[], int w, int h)
         w, h
     );
 
-    if (window->texture == NULL) {
+    return window->texture != NULL;
+}
+
+static void destroy_renderer(window_t* window)
+{
+    if (window->texture != NULL) {
+        SDL_DestroyTexture(window->texture);
+        window->texture = NULL;
+    }
+
+    if (window->renderer != NULL) {
+        SDL_DestroyRenderer(window->renderer);
+        window->renderer = NULL;
+    }
+
+    window->vsync_enabled = false;
+}
+
+bool window_init(window_t* window, const char name[], int w, int h)
+{
+    memset(window, 0, sizeof *window);
+
+    window->window = SDL_CreateWindow(
+        name,
+        SDL_WINDOWPOS_UNDEFINED,
+        SDL_WINDOWPOS_UNDEFINED,
+        w, h,
+        SDL_WINDOW_RESIZABLE
+    );
+
+    if (window->window == NULL) {
         goto error;
     }
 
+    SDL_SetWindowData(window->window, WINDOW_DATA, window);
+
     uint32_t r, g, b, a;
     int bpp;
 
@@ -53,7 +81,12 @@ bool window_init(window_t* window, const char name[], int w, int h)
         goto error;
     }
 
+    if (!create_renderer(window)) {
+        goto error;
+    }
+
     window->bg_color = SDL_MapRGB(window->surface->format, 0xff, 0xff, 0xff);
+    atomic_store(&window->redraw, true);
 
     return true;
 
@@ -65,21 +98,25 @@ bool window_init(window_t* window, const char name[], int w, int h)
 
 void window_destroy(window_t* window)
 {
-    if (window->renderer != NULL) {
-        SDL_DestroyRenderer(window->renderer);
-        window->renderer = NULL;
+    if (window->thread != NULL) {
+        atomic_store(&window->quit, true);
+        SDL_SemPost(window->wakeup);
+        SDL_WaitThread(window->thread, NULL);
+        window->thread = NULL;
     }
 
+    if (window->wakeup != NULL) {
+        SDL_DestroySemaphore(window->wakeup);
+        window->wakeup = NULL;
+    }
+
+    destroy_renderer(window);
+
     if (window->window != NULL) {
         SDL_DestroyWindow(window->window);
         window->window = NULL;
     }
 
-    if (window->texture != NULL) {
-        SDL_DestroyTexture(window->texture);
-        window->texture = NULL;
-    }
-
     if (window->surface != NULL) {
         SDL_FreeSurface(window->surface);
         window->surface = NULL;
@@ -122,3 +159,305 @@ void window_draw(window_t* window)
     SDL_RenderCopy(window->renderer, window->texture, NULL, NULL);
     SDL_RenderPresent(window->renderer);
 }
+
+/*
+ * Updates the predicted refresh interval and upload time after a frame
+ * has been presented with vsync. Intervals far off the prediction are
+ * missed or skipped refreshes and don't count.
+ */
+static void predict_update(window_t* window, uint64_t upload,
+    uint64_t presented)
+{
+    const uint64_t interval = presented - window->last_present;
+
+    if (interval > window->refresh_ticks / 2 &&
+        interval < window->refresh_ticks * 3 / 2)
+    {
+        window->refresh_ticks = (window->refresh_ticks * 7 + interval) / 8;
+    }
+
+    // Follow slow uploads right away, fast ones gradually.
+    if (upload > window->upload_ticks) {
+        window->upload_ticks = upload;
+    } else {
+        window->upload_ticks = (window->upload_ticks * 7 + upload) / 8;
+    }
+
+    window->last_present = presented;
+}
+
+/*
+ * Sleeps until just before the predicted start of the upload for the
+ * next vsync, so that the freshest frame gets presented.
+ */
+static void wait_for_upload(window_t* window)
+{
+    const uint64_t freq = SDL_GetPerformanceFrequency();
+    const uint64_t margin = freq / 1000;
+    const uint64_t deadline = window->last_present + window->refresh_ticks;
+    const uint64_t now = SDL_GetPerformanceCounter();
+
+    if (deadline > now + window->upload_ticks + margin) {
+        SDL_Delay((deadline - now - window->upload_ticks - margin) * 1000 /
+            freq);
+    }
+}
+
+static void apply_vsync(window_t* window)
+{
+    const bool vsync = atomic_load(&window->vsync);
+
+    if (vsync == window->vsync_enabled) {
+        return;
+    }
+
+    SDL_RenderSetVSync(window->renderer, vsync);
+    window->vsync_enabled = vsync;
+
+    if (vsync) {
+        SDL_DisplayMode mode;
+        int refresh_rate = 60;
+
+        if (SDL_GetWindowDisplayMode(window->window, &mode) == 0 &&
+            mode.refresh_rate > 0)
+        {
+            refresh_rate = mode.refresh_rate;
+        }
+
+        window->refresh_ticks = SDL_GetPerformanceFrequency() / refresh_rate;
+        window->upload_ticks = 0;
+        window->last_present = SDL_GetPerformanceCounter();
+    }
+}
+
+/*
+ * Narrows <dirty> down to the lines of <frame> that differ from the ones
+ * on screen. Returns false if there are none, which happens if the hash
+ * of the whole frame collided.
+ */
+bool window_dirty_lines(const window_t* window, const frame_t* frame,
+    SDL_Rect* dirty)
+{
+    int first = 0, last = SCREEN_HEIGHT - 1;
+
+    while (first < SCREEN_HEIGHT &&
+        frame->line_hashes[first] == window->shown_hashes[first])
+    {
+        first++;
+    }
+
+    if (first == SCREEN_HEIGHT) {
+        return false;
+    }
+
+    while (frame->line_hashes[last] == window->shown_hashes[last]) {
+        last--;
+    }
+
+    dirty->y = first;
+    dirty->h = last - first + 1;
+
+    return true;
+}
+
+/*
+ * Expands the lines of <frame> that differ from the one on screen
+ * straight into the streaming texture and presents it. Does nothing if
+ * the frame didn't change at all.
+ */
+static void present_frame(window_t* window, const frame_t* frame)
+{
+    SDL_Rect dirty = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    void* pixels;
+    int pitch;
+
+    apply_vsync(window);
+
+    if (!atomic_exchange(&window->redraw, false)) {
+        if (frame->hash == window->shown_hash) {
+            atomic_fetch_add(&window->unchanged, 1);
+            return;
+        }
+
+        if (!window_dirty_lines(window, frame, &dirty)) {
+            atomic_fetch_add(&window->unchanged, 1);
+            return;
+        }
+    }
+
+    const uint64_t start = SDL_GetPerformanceCounter();
+
+    if (SDL_LockTexture(window->texture, &dirty, &pixels, &pitch) < 0) {
+        atomic_store(&window->redraw, true);
+        return;
+    }
+
+    for (int y = 0; y < dirty.h; y++) {
+        uint32_t* row = (uint32_t*)((uint8_t*)pixels + y * pitch);
+        const uint8_t* src = frame->pixels[dirty.y + y];
+
+        for (size_t x = 0; x < SCREEN_WIDTH; x++) {
+            row[x] = window->colors[src[x]];
+        }
+    }
+
+    SDL_UnlockTexture(window->texture);
+
+    memcpy(window->shown_hashes, frame->line_hashes,
+        sizeof window->shown_hashes);
+    window->shown_hash = frame->hash;
+
+    // The back buffer is undefined after presenting, this clears the
+    // letterbox around the texture.
+    SDL_RenderClear(window->renderer);
+    SDL_RenderCopy(window->renderer, window->texture, NULL, NULL);
+
+    const uint64_t uploaded = SDL_GetPerformanceCounter();
+
+    SDL_RenderPresent(window->renderer);
+
+    const uint64_t now = SDL_GetPerformanceCounter();
+
+    if (window->vsync_enabled) {
+        predict_update(window, uploaded - start, now);
+    }
+
+    const uint64_t latency_us = (now - frame->timestamp) * 1000000 /
+        SDL_GetPerformanceFrequency();
+
+    atomic_store(&window->latency_us, latency_us);
+    if (latency_us > atomic_load(&window->max_latency_us)) {
+        atomic_store(&window->max_latency_us, latency_us);
+    }
+    atomic_fetch_add(&window->presented, 1);
+}
+
+static int present_thread(void* data)
+{
+    window_t* window = data;
+
+    // The renderer belongs to this thread from now on, see
+    // window_start_thread.
+    const bool ok = create_renderer(window);
+
+    SDL_SemPost(window->started);
+
+    if (!ok) {
+        destroy_renderer(window);
+        return 1;
+    }
+
+    atomic_store(&window->redraw, true);
+
+    while (!atomic_load(&window->quit)) {
+        if (window->vsync_enabled) {
+            wait_for_upload(window);
+        }
+
+        if (SDL_SemWaitTimeout(window->wakeup, 100) != 0) {
+            continue;
+        }
+
+        // Wakeups for frames that have been replaced in the meantime.
+        while (SDL_SemTryWait(window->wakeup) == 0) {
+        }
+
+        if (tb_acquire(window->frames) || atomic_load(&window->redraw)) {
+            present_frame(window, (const frame_t*)tb_front(window->frames));
+        }
+    }
+
+    destroy_renderer(window);
+
+    return 0;
+}
+
+/*
+ * Presents frames published to <frames> on a separate thread, so that
+ * emulation does not wait for the renderer or for vsync. SDL renderers
+ * are bound to the thread that created them, so the window's renderer
+ * is created again on the presenter thread, and must not be used by
+ * anyone else afterwards.
+ */
+bool window_start_thread(window_t* window, triple_buffer* frames)
+{
+    int status;
+
+    window->frames = frames;
+    atomic_store(&window->quit, false);
+
+    window->wakeup = SDL_CreateSemaphore(0);
+    window->started = SDL_CreateSemaphore(0);
+    if (window->wakeup == NULL || window->started == NULL) {
+        goto error;
+    }
+
+    destroy_renderer(window);
+
+    window->thread = SDL_CreateThread(present_thread, "present", window);
+    if (window->thread == NULL) {
+        goto error;
+    }
+
+    // Wait until the presenter thread has its renderer.
+    SDL_SemWait(window->started);
+    SDL_DestroySemaphore(window->started);
+    window->started = NULL;
+
+    if (window->renderer == NULL) {
+        SDL_WaitThread(window->thread, &status);
+        window->thread = NULL;
+        goto error;
+    }
+
+    return true;
+
+    error: {
+        if (window->started != NULL) {
+            SDL_DestroySemaphore(window->started);
+            window->started = NULL;
+        }
+
+        if (window->wakeup != NULL) {
+            SDL_DestroySemaphore(window->wakeup);
+            window->wakeup = NULL;
+        }
+
+        return false;
+    }
+}
+
+/*
+ * Presents the most recently published frame, either by waking up the
+ * presenter thread or right away if there is none.
+ */
+void window_present(window_t* window, triple_buffer* frames)
+{
+    if (window->thread != NULL) {
+        SDL_SemPost(window->wakeup);
+    } else if (tb_acquire(frames) || atomic_load(&window->redraw)) {
+        present_frame(window, (const frame_t*)tb_front(frames));
+    }
+}
+
+/*
+ * Presents in sync with the display's refresh. Uploads are timed to
+ * start just before the vsync, so a frame is usually on screen one
+ * refresh after it was finished.
+ */
+void window_set_vsync(window_t* window, bool enabled)
+{
+    atomic_store(&window->vsync, enabled);
+}
+
+/*
+ * Presents the whole frame again, even if it didn't change.
+ */
+void window_invalidate(window_t* window)
+{
+    atomic_store(&window->redraw, true);
+
+    if (window->thread != NULL) {
+        SDL_SemPost(window->wakeup);
+    }
+}
@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "writer.h"
+
+#define WRITER_BATCH (1 << 20)
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static void flush(writer_t* writer)
+{
+    size_t done = 0;
+
+    while (done < writer->batch_len) {
+        ssize_t n = write(writer->fd, writer->batch + done,
+            writer->batch_len - done);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            atomic_store(&writer->failed, true);
+            break;
+        }
+
+        done += n;
+    }
+
+    writer->batch_len = 0;
+}
+
+static void drain(writer_t* writer)
+{
+    const uint8_t* item;
+
+    while ((item = rb_peek(writer->queue)) != NULL) {
+        if (writer->batch_len + writer->max_encoded > writer->batch_size) {
+            flush(writer);
+        }
+
+        writer->batch_len += writer->encode(writer->user, item,
+            writer->batch + writer->batch_len);
+
+        rb_release(writer->queue);
+        atomic_fetch_add(&writer->written, 1);
+    }
+}
+
+static int writer_thread(void* data)
+{
+    writer_t* writer = data;
+
+    while (!atomic_load(&writer->quit)) {
+        SDL_SemWaitTimeout(writer->wakeup, 100);
+        drain(writer);
+    }
+
+    drain(writer);
+    flush(writer);
+
+    return 0;
+}
+
+/*
+ * Creates <filename> and starts writing <header> to it, followed by each
+ * committed item after it was passed through <encode>. The queue holds
+ * <queue_len> items of <item_len> bytes, an encoded item takes up at
+ * most <max_encoded> bytes.
+ */
+writer_t* writer_open(const char* filename, const void* header,
+    size_t header_len, size_t item_len, size_t queue_len,
+    writer_encode_t encode, size_t max_encoded, void* user)
+{
+    writer_t* writer = malloc(sizeof *writer);
+
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    memset(writer, 0, sizeof *writer);
+
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (writer->fd < 0) {
+        goto error;
+    }
+
+    // A batch holds at least one encoded item.
+    writer->batch_size = MAX(WRITER_BATCH, MAX(header_len, max_encoded));
+    writer->queue = rb_init(queue_len, item_len);
+    writer->batch = malloc(writer->batch_size);
+
+    if (writer->queue == NULL || writer->batch == NULL) {
+        goto error;
+    }
+
+    memcpy(writer->batch, header, header_len);
+    writer->batch_len   = header_len;
+    writer->encode      = encode;
+    writer->max_encoded = max_encoded;
+    writer->user        = user;
+
+    writer->wakeup = SDL_CreateSemaphore(0);
+
+    if (writer->wakeup == NULL) {
+        goto error;
+    }
+
+    writer->thread = SDL_CreateThread(writer_thread, "writer", writer);
+
+    if (writer->thread == NULL) {
+        goto error;
+    }
+
+    return writer;
+
+    error: {
+        if (writer->wakeup != NULL) {
+            SDL_DestroySemaphore(writer->wakeup);
+        }
+
+        if (writer->fd >= 0) {
+            close(writer->fd);
+        }
+
+        rb_destroy(writer->queue);
+        free(writer->batch);
+        free(writer);
+        return NULL;
+    }
+}
+
+/*
+ * The item to fill next, or NULL if the writer fell behind. In that case
+ * the item is dropped.
+ */
+uint8_t* writer_reserve(writer_t* writer)
+{
+    uint8_t* item = rb_reserve(writer->queue);
+
+    if (item == NULL) {
+        atomic_fetch_add(&writer->dropped, 1);
+    }
+
+    return item;
+}
+
+/*
+ * Like writer_reserve, but waits for the writer instead of dropping the
+ * item, for streams that must not have gaps.
+ */
+uint8_t* writer_reserve_wait(writer_t* writer)
+{
+    uint8_t* item;
+
+    while ((item = rb_reserve(writer->queue)) == NULL) {
+        SDL_SemPost(writer->wakeup);
+        SDL_Delay(1);
+    }
+
+    return item;
+}
+
+void writer_commit(writer_t* writer)
+{
+    rb_commit(writer->queue);
+    SDL_SemPost(writer->wakeup);
+}
+
+/*
+ * Writes all queued items and closes the file. Returns false if
+ * anything could not be written or was dropped.
+ */
+bool writer_close(writer_t* writer)
+{
+    bool ok;
+
+    atomic_store(&writer->quit, true);
+    SDL_SemPost(writer->wakeup);
+    SDL_WaitThread(writer->thread, NULL);
+
+    ok = !atomic_load(&writer->failed) && atomic_load(&writer->dropped) == 0;
+
+    if (close(writer->fd) < 0) {
+        ok = false;
+    }
+
+    SDL_DestroySemaphore(writer->wakeup);
+    rb_destroy(writer->queue);
+    free(writer->batch);
+    free(writer);
+
+    return ok;
+}